@@ -277,7 +277,7 @@ else:
 
         # add user extra args
         if len(flags) > 0:
-            command.append(flags)
+            command += flags.split()
 
 
         # call gcc
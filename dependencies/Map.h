@@ -4,6 +4,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 typedef struct Element {
     char* key;
@@ -11,6 +15,63 @@ typedef struct Element {
     void* data;
 } Element;
 
+
+/*
+    Compile with '-DMAP_STATS' and every map keeps counters on how well it's doing, printed with
+    'print_map_stats', 'print_flat_map_stats' and 'print_concurrent_map_stats'. Without it the maps
+    carry no counters and the print functions only show the size, load factor and bytes.
+
+    'probes' is how many extra slots an operation looked at past the key's first slot. A healthy
+    table has nearly all operations in the first couple of histogram buckets.
+*/
+#define MAP_STATS_PROBE_BUCKETS 16 // the last bucket counts everything longer
+
+typedef struct {
+    size_t operations;
+    size_t probe_histogram[MAP_STATS_PROBE_BUCKETS];
+    size_t max_probe;
+    size_t resizes;
+    double rehash_seconds;
+} MapStats;
+
+#ifdef MAP_STATS
+
+// relaxed atomics so the concurrent map's readers can count too
+static void map_stats_record_probe(MapStats* stats, size_t probes) {
+    size_t bucket = probes < MAP_STATS_PROBE_BUCKETS? probes : MAP_STATS_PROBE_BUCKETS - 1;
+    __atomic_fetch_add(&stats->operations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->probe_histogram[bucket], 1, __ATOMIC_RELAXED);
+
+    size_t max = __atomic_load_n(&stats->max_probe, __ATOMIC_RELAXED);
+    while (probes > max && !__atomic_compare_exchange_n(&stats->max_probe, &max, probes, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static double map_stats_now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif
+
+static void print_stats(const char* name, MapStats* stats, size_t len, size_t capacity, size_t bytes) {
+    printf("%s: %zu elements, %zu slots, load %.2f, %zu bytes\n", name, len, capacity, capacity? (double)len / capacity : 0, bytes);
+    if (stats == NULL) {
+        printf("    (compile with -DMAP_STATS for probe counts)\n");
+        return;
+    }
+
+    printf("    operations %zu, max probe %zu, resizes %zu, rehashing %.3f ms\n",
+        stats->operations, stats->max_probe, stats->resizes, stats->rehash_seconds * 1e3);
+    printf("    probes:");
+    for (int i = 0; i < MAP_STATS_PROBE_BUCKETS; i++) {
+        if (stats->probe_histogram[i] == 0) continue;
+        printf(" %s%d: %.1f%%", i == MAP_STATS_PROBE_BUCKETS - 1? ">=" : "", i,
+            100.0 * stats->probe_histogram[i] / (stats->operations? stats->operations : 1));
+    }
+    printf("\n");
+}
+
 /*
     An unordered hash map implementation.
 
@@ -118,6 +179,9 @@ typedef struct Map {
     Element** data; // pointer to array of pointers
     size_t data_size;
     size_t len;
+#ifdef MAP_STATS
+    MapStats stats;
+#endif
 } Map;
 
 const char* DELETED_KEY = "<DELETED>";
@@ -179,16 +243,16 @@ static Map* new_map_s(size_t size) {
     if (map == NULL) {
         map_mem_error_exit_failing();
     }
-    map->data = malloc(size * sizeof(void*));
+    map->data = calloc(size, sizeof(Element*));
     if (map->data == NULL) {
         free(map);
         map_mem_error_exit_failing();
     }
     map->data_size = size;
-    for (int i = 0; i < size; ++i) {
-        map->data[i] = NULL;
-    }
     map->len = 0;
+#ifdef MAP_STATS
+    memset(&map->stats, 0, sizeof(MapStats));
+#endif
 
     return map;
 }
@@ -281,6 +345,10 @@ static size_t probe(Map* map, void* key, size_t key_size, int* hash_collisions)
         }
     }
 
+#ifdef MAP_STATS
+    map_stats_record_probe(&map->stats, *hash_collisions);
+#endif
+
     return index;
 }
 
@@ -350,49 +418,184 @@ static void insert_no_resize(Map* map, void* key, size_t key_size, void* data, s
 
 }
 
+static int is_deleted_element(Element* element) {
+    size_t DELETED_KEY_SIZE = strlen(DELETED_KEY) + 1;
+    return element->key_size == DELETED_KEY_SIZE && strcmp(element->key, DELETED_KEY) == 0;
+}
+
+/*
+    Smallest table size in 'PRIMES' that holds 'len' elements without going over 70% full
+*/
+static size_t table_size_for(size_t len) {
+    size_t NUM_PRIMES = sizeof(PRIMES) / sizeof(PRIMES[0]);
+    for (size_t i = 0; i < NUM_PRIMES; ++i) {
+        if (PRIMES[i] * 0.7 >= len) {
+            return PRIMES[i];
+        }
+    }
+    return PRIMES[NUM_PRIMES - 1];
+}
+
+/*
+    Places an element already owned by the map into an empty slot
+*/
+static void place_element(Map* map, Element* element) {
+    int hash_collisions = 0;
+    size_t index = probe(map, element->key, element->key_size, &hash_collisions);
+    if (map->data[index] != NULL) {
+        fprintf(stderr, "Element already exists. Aborting to avoid leaving an unfreed pointer. (use 'm_put()' to overwrite elements or simply retrieve and modify elements) Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    map->data[index] = element;
+    ++map->len;
+}
+
+/*
+    Moves the elements into a new table of 'new_table_size'. Elements and keys are kept, only the
+    table itself is reallocated.
+*/
+static void rehash_map(Map* map, size_t new_table_size) {
+#ifdef MAP_STATS
+    double start = map_stats_now();
+#endif
+    Element** old_data = map->data;
+    size_t old_size = map->data_size;
+
+    map->data = calloc(new_table_size, sizeof(Element*));
+    if (map->data == NULL) {
+        map_mem_error_exit_failing();
+    }
+    map->data_size = new_table_size;
+    map->len = 0;
+
+    for (size_t i = 0; i < old_size; ++i) {
+        if (old_data[i] != NULL && !is_deleted_element(old_data[i])) {
+            place_element(map, old_data[i]);
+        }
+    }
+
+    free(old_data);
+#ifdef MAP_STATS
+    map->stats.resizes++;
+    map->stats.rehash_seconds += map_stats_now() - start;
+#endif
+}
+
 static void resize_map(Map* map) {
     size_t NUM_PRIMES = sizeof(PRIMES) / sizeof(PRIMES[0]);
 
     // get next table size
     size_t new_table_size = PRIMES[0];
-    for (int i = 0; i < NUM_PRIMES; ++i) {
+    for (size_t i = 0; i < NUM_PRIMES; ++i) {
         if (PRIMES[i] > map->data_size) {
             new_table_size = PRIMES[i];
             break;
         }
     }
 
-    // make new table and insert each element
-    size_t DELETED_KEY_SIZE = strlen(DELETED_KEY) + 1;
-    Map* new_map = new_map_s(new_table_size);
-    for (size_t i = 0; i < map->data_size; ++i) {
+    rehash_map(map, new_table_size);
+}
 
-        // if an element insert into new map
-        if (map->data[i] != NULL) {
+/*
+    Creates an empty map big enough for 'len' elements, so filling it won't resize
+*/
+Map* new_map_reserved(size_t len) {
+    return new_map_s(table_size_for(len));
+}
 
-            // check if deleted
-            int deleted = 0;
-            if (map->data[i]->key_size == DELETED_KEY_SIZE) {
-                if (strcmp(map->data[i]->key, DELETED_KEY) == 0) {
-                    deleted = 1;
-                }
-            }
+/*
+    Grows the map so it can hold 'len' elements without resizing again. Does nothing if it
+    already can.
+*/
+void m_reserve(Map* map, size_t len) {
+    size_t table_size = table_size_for(len);
+    if (table_size > map->data_size) {
+        rehash_map(map, table_size);
+    }
+}
 
-            // an element insert into map
-            if (!deleted) {
-                Element* element = map->data[i];
-                insert_no_resize(new_map, element->key, element->key_size, element->data, -1);
-            }
+
+/*
+    Collects elements and then builds a map of them all at once, sizing the table a single
+    time. Handy when you don't know the number of elements up front.
+
+    Used like so:
+    ```
+    MapBuilder* builder = new_map_builder(0);
+    mb_add(builder, "key_1", &object_1);
+    mb_add(builder, "key_2", &object_2);
+
+    Map* map = mb_build(builder); // frees the builder
+    ```
+
+    Like 'm_unique', duplicate keys aren't allowed.
+*/
+typedef struct MapBuilder {
+    Element** elements;
+    size_t len;
+    size_t capacity;
+} MapBuilder;
+
+/*
+    Creates a builder. 'expected_len' is just a hint and can be 0.
+*/
+MapBuilder* new_map_builder(size_t expected_len) {
+    MapBuilder* builder = malloc(sizeof(MapBuilder));
+    if (builder == NULL) {
+        map_mem_error_exit_failing();
+    }
+    builder->capacity = expected_len > 16? expected_len : 16;
+    builder->elements = malloc(builder->capacity * sizeof(Element*));
+    if (builder->elements == NULL) {
+        map_mem_error_exit_failing();
+    }
+    builder->len = 0;
+    return builder;
+}
+
+void mb_any_add(MapBuilder* builder, void* key, size_t key_size, void* data) {
+    if (builder->len == builder->capacity) {
+        builder->capacity *= 2;
+        Element** elements = realloc(builder->elements, builder->capacity * sizeof(Element*));
+        if (elements == NULL) {
+            map_mem_error_exit_failing();
         }
+        builder->elements = elements;
     }
 
-    free_map_data(map);
-    map->data = new_map->data;
-    map->data_size = new_map->data_size;
-    map->len = new_map->len;
+    Element *element = malloc(sizeof(Element));
+    char* key_copy = malloc(key_size);
+    if (element == NULL || key_copy == NULL) {
+        map_mem_error_exit_failing();
+    }
+    memcpy(key_copy, key, key_size);
+    element->key = key_copy;
+    element->key_size = key_size;
+    element->data = data;
+
+    builder->elements[builder->len++] = element;
+}
+
+void mb_int_add(MapBuilder* builder, int key, void* data) {
+    mb_any_add(builder, &key, sizeof(int), data);
+}
+
+void mb_add(MapBuilder* builder, char* key, void* data) {
+    mb_any_add(builder, key, (strlen(key) + 1) * sizeof(char), data);
+}
+
+/*
+    Builds the map from everything added and frees the builder
+*/
+Map* mb_build(MapBuilder* builder) {
+    Map* map = new_map_reserved(builder->len);
+    for (size_t i = 0; i < builder->len; ++i) {
+        place_element(map, builder->elements[i]);
+    }
 
-    new_map->data = NULL; // so it won't free the data array copied above
-    free(new_map);
+    free(builder->elements);
+    free(builder);
+    return map;
 }
 
 
@@ -673,5 +876,843 @@ int m_contains(Map* map, char* key) {
     return m_any_contains(map, key, (strlen(key) + 1) * sizeof(char));
 }
 
+
+/*
+    A flat variant of the map above. Same idea and the same functions (prefixed with 'fm_'
+    instead of 'm_'), but laid out for fewer cache misses and allocations.
+
+    Used like so:
+    ```
+    FlatMap* map = new_flat_map();
+    MyStruct object = {1, 3};
+    fm_unique(map, "my_key", &object);
+
+    MyStruct* back_out = (MyStruct*) fm_get(map, "my_key");
+
+    fm_int_unique(map, 12, &object);
+    back_out = (MyStruct*) fm_int_get(map, 12);
+
+    fm_erase(map, "my_key");
+
+    Element* items = flat_map_elements(map);
+    for (int i = 0; i < map->len; ++i) {
+        MyStruct obj = *(MyStruct*) items[i].data;
+    }
+    free(items); // the keys point into the map, so only free the array
+
+    free_flat_map(map);
+    ```
+
+    Like the other map it doesn't free any items placed in it.
+
+
+
+    # DESIGN
+
+    All elements live in one contiguous array of 24 byte slots (no allocation per element). Each
+    slot holds 32 bits of its key's hash, so most mismatches are rejected without touching the key,
+    and keys up to FLAT_INLINE_KEY bytes (ints and 64 bit ids) are stored in the slot itself. Longer
+    keys are copied into one shared key buffer and the slot stores their offset.
+
+    The table size is a power of two, so the slot for a hash is 'hash & (capacity - 1)'. Keys are
+    hashed 8 bytes at a time and finished with a murmur3 style mixer so the low bits are well spread.
+    Collisions use linear probing, and erasing shifts the following elements back instead of leaving
+    'deleted' markers, so lookups never walk over tombstones. The table doubles when it's 75% full,
+    the key buffer grows by half so it doesn't carry much unused space.
+
+    Keys that fit in the slot (ints, 64 bit ids, small structs) are where it beats 'Map' on both
+    speed and memory. Long string keys look up faster too, but a lightly loaded table of 24 byte
+    slots can take more memory than 'Map', so string keyed tables are still better off in 'Map'.
+
+*/
+
+#define FLAT_INLINE_KEY 8
+
+typedef struct {
+    uint32_t hash; // 0 means the slot is empty
+    uint32_t key_size;
+    union {
+        char inline_key[FLAT_INLINE_KEY]; // keys up to FLAT_INLINE_KEY bytes
+        uint64_t key_offset; // offset into the map's 'keys' buffer for longer keys
+    };
+    void* data;
+} FlatSlot;
+
+typedef struct FlatMap {
+    FlatSlot* slots;
+    size_t capacity; // always a power of two
+    size_t len;
+
+    char* keys; // buffer holding keys longer than FLAT_INLINE_KEY, in the order they were added
+    size_t keys_len;
+    size_t keys_capacity;
+    size_t keys_erased; // bytes of 'keys' left behind by erased elements
+#ifdef MAP_STATS
+    MapStats stats;
+#endif
+} FlatMap;
+
+#define FLAT_MIN_CAPACITY 16
+
+
+static FlatMap* new_flat_map_s(size_t capacity) {
+    FlatMap* map = malloc(sizeof(FlatMap));
+    if (map == NULL) {
+        map_mem_error_exit_failing();
+    }
+    map->slots = calloc(capacity, sizeof(FlatSlot));
+    if (map->slots == NULL) {
+        free(map);
+        map_mem_error_exit_failing();
+    }
+    map->capacity = capacity;
+    map->len = 0;
+    map->keys = NULL;
+    map->keys_len = 0;
+    map->keys_capacity = 0;
+    map->keys_erased = 0;
+#ifdef MAP_STATS
+    memset(&map->stats, 0, sizeof(MapStats));
+#endif
+
+    return map;
+}
+
+/*
+    Creates an empty flat map
+*/
+FlatMap* new_flat_map() {
+    return new_flat_map_s(FLAT_MIN_CAPACITY);
+}
+
+/*
+    Frees the map's own memory. Like 'free_map', objects placed in the map are left to you.
+*/
+void free_flat_map(FlatMap* map) {
+    free(map->slots);
+    free(map->keys);
+    free(map);
+}
+
+static uint32_t flat_hash(const void* key, size_t key_size) {
+    const unsigned char* bytes = (const unsigned char*)key;
+
+    // a word at a time, then whatever bytes are left
+    uint64_t hash = 14695981039346656037ULL ^ key_size;
+    size_t i = 0;
+    for (; i + 8 <= key_size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+    if (i < key_size) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, key_size - i);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    // murmur3 finalizer, spreads the bits so 'hash & mask' is usable
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return (uint32_t)hash == 0? 1 : (uint32_t)hash;
+}
+
+static const char* flat_slot_key(FlatMap* map, FlatSlot* slot) {
+    return (slot->key_size <= FLAT_INLINE_KEY)? slot->inline_key : map->keys + slot->key_offset;
+}
+
+static void flat_set_key(FlatMap* map, FlatSlot* slot, const void* key, size_t key_size) {
+    slot->key_size = (uint32_t)key_size;
+    if (key_size <= FLAT_INLINE_KEY) {
+        memset(slot->inline_key, 0, FLAT_INLINE_KEY); // zero padded so short keys compare as one word
+        memcpy(slot->inline_key, key, key_size);
+        return;
+    }
+
+    if (map->keys_len + key_size > map->keys_capacity) {
+        size_t new_capacity = map->keys_capacity == 0? 256 : map->keys_capacity + map->keys_capacity / 2;
+        if (new_capacity < map->keys_len + key_size) new_capacity = map->keys_len + key_size;
+        char* new_keys = realloc(map->keys, new_capacity);
+        if (new_keys == NULL) {
+            map_mem_error_exit_failing();
+        }
+        map->keys = new_keys;
+        map->keys_capacity = new_capacity;
+    }
+    memcpy(map->keys + map->keys_len, key, key_size);
+    slot->key_offset = map->keys_len;
+    map->keys_len += key_size;
+}
+
+/*
+    Returns the slot holding the key, or the empty slot where it would go.
+*/
+static FlatSlot* flat_probe(FlatMap* map, const void* key, size_t key_size, uint32_t hash) {
+    size_t mask = map->capacity - 1;
+    size_t index = hash & mask;
+
+    // short keys are compared as a zero padded word, like they're stored
+    int is_inline = key_size <= FLAT_INLINE_KEY;
+    uint64_t inline_key = 0;
+    if (is_inline) {
+        memcpy(&inline_key, key, key_size);
+    }
+
+    for (size_t probes = 0;; probes++) {
+        FlatSlot* slot = &map->slots[index];
+        int found = slot->hash == 0;
+        if (!found && slot->hash == hash && slot->key_size == key_size) {
+            found = is_inline? slot->key_offset == inline_key : memcmp(map->keys + slot->key_offset, key, key_size) == 0;
+        }
+        if (found) {
+#ifdef MAP_STATS
+            map_stats_record_probe(&map->stats, probes);
 #endif
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void flat_rehash(FlatMap* map, size_t new_capacity) {
+#ifdef MAP_STATS
+    double start = map_stats_now();
+#endif
+    FlatSlot* old_slots = map->slots;
+    size_t old_capacity = map->capacity;
+    char* old_keys = NULL;
 
+    map->slots = calloc(new_capacity, sizeof(FlatSlot));
+    if (map->slots == NULL) {
+        map_mem_error_exit_failing();
+    }
+    map->capacity = new_capacity;
+
+    // long keys stay where they are, unless erased elements left holes to drop by copying the rest
+    int compact_keys = map->keys_erased > 0;
+    if (compact_keys) {
+        old_keys = map->keys;
+        map->keys = malloc(map->keys_len - map->keys_erased);
+        if (map->keys == NULL) {
+            map_mem_error_exit_failing();
+        }
+        map->keys_capacity = map->keys_len - map->keys_erased;
+        map->keys_len = 0;
+        map->keys_erased = 0;
+    }
+
+    size_t mask = new_capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        FlatSlot* old = &old_slots[i];
+        if (old->hash == 0) continue;
+
+        size_t index = old->hash & mask;
+        while (map->slots[index].hash != 0) {
+            index = (index + 1) & mask;
+        }
+
+        FlatSlot* slot = &map->slots[index];
+        *slot = *old;
+        if (compact_keys && old->key_size > FLAT_INLINE_KEY) {
+            flat_set_key(map, slot, old_keys + old->key_offset, old->key_size);
+        }
+    }
+
+    free(old_slots);
+    free(old_keys);
+#ifdef MAP_STATS
+    map->stats.resizes++;
+    map->stats.rehash_seconds += map_stats_now() - start;
+#endif
+}
+
+/*
+    Grows the map so it can hold 'len' elements without resizing again. Does nothing if it
+    already can.
+*/
+void fm_reserve(FlatMap* map, size_t len) {
+    size_t capacity = map->capacity;
+    while (len * 4 > capacity * 3) {
+        capacity *= 2;
+    }
+    if (capacity > map->capacity) {
+        flat_rehash(map, capacity);
+    }
+}
+
+/*
+    Creates an empty flat map big enough for 'len' elements, so filling it won't resize
+*/
+FlatMap* new_flat_map_reserved(size_t len) {
+    size_t capacity = FLAT_MIN_CAPACITY;
+    while (len * 4 > capacity * 3) {
+        capacity *= 2;
+    }
+    return new_flat_map_s(capacity);
+}
+
+static void flat_insert(FlatMap* map, const void* key, size_t key_size, void* data, size_t data_size) {
+
+    // grow first so the slot found below stays valid
+    if ((map->len + 1) * 4 > map->capacity * 3) {
+        flat_rehash(map, map->capacity * 2);
+    }
+
+    uint32_t hash = flat_hash(key, key_size);
+    FlatSlot* slot = flat_probe(map, key, key_size, hash);
+
+    // if new element
+    if (slot->hash == 0) {
+        slot->hash = hash;
+        flat_set_key(map, slot, key, key_size);
+        slot->data = data;
+        ++map->len;
+    }
+    else {
+        if (data_size != (size_t)-1) {
+            memcpy(slot->data, data, data_size);
+        }
+        else {
+            fprintf(stderr, "Element already exists. Aborting to avoid leaving an unfreed pointer. (use 'fm_put()' to overwrite elements or simply retrieve and modify elements) Exiting...");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+    Function to insert an object in the map, with any other object used as the key.
+    Does not allow overwriting existing elements (see 'm_any_unique').
+*/
+void fm_any_unique(FlatMap* map, void* key, size_t key_size, void* data) {
+    flat_insert(map, key, key_size, data, -1);
+}
+
+/*
+    Function to insert an object in the map using an int as the key.
+    Does not allow overwriting existing elements.
+*/
+void fm_int_unique(FlatMap* map, int key, void* data) {
+    fm_any_unique(map, &key, sizeof(int), data);
+}
+
+/*
+    Function to insert an object in the map using a string as the key.
+    Does not allow overwriting existing elements.
+*/
+void fm_unique(FlatMap* map, char* key, void* data) {
+    fm_any_unique(map, key, (strlen(key) + 1) * sizeof(char), data);
+}
+
+/*
+    Function to insert an object in the map, with any other object used as the key.
+    If the key exists, 'data_size' bytes of 'data' are copied over the existing object (see 'm_any_put').
+*/
+void fm_any_put(FlatMap* map, void* key, size_t key_size, void* data, size_t data_size) {
+    flat_insert(map, key, key_size, data, data_size);
+}
+
+/*
+    Function to insert an object in the map using an int as the key.
+*/
+void fm_int_put(FlatMap* map, int key, void* data, size_t data_size) {
+    fm_any_put(map, &key, sizeof(int), data, data_size);
+}
+
+/*
+    Function to insert an object in the map using a string as the key. The key is copied.
+*/
+void fm_put(FlatMap* map, char* key, void* data, size_t data_size) {
+    fm_any_put(map, key, (strlen(key) + 1) * sizeof(char), data, data_size);
+}
+
+/*
+    Function to get an object in the map, with any other object used as the key.
+
+    Returns a NULL pointer if no object exists at the key
+*/
+void* fm_any_get(FlatMap* map, void* key, size_t key_size) {
+    FlatSlot* slot = flat_probe(map, key, key_size, flat_hash(key, key_size));
+    return slot->hash == 0? NULL : slot->data;
+}
+
+/*
+    Function to get an object in the map, using an int as the key
+*/
+void* fm_int_get(FlatMap* map, int key) {
+    return fm_any_get(map, &key, sizeof(key));
+}
+
+/*
+    Function to get an object in the map, using an string as the key
+*/
+void* fm_get(FlatMap* map, char* key) {
+    return fm_any_get(map, key, (strlen(key) + 1) * sizeof(char));
+}
+
+/*
+    Function to erase an object in the map, with any other object used as the key.
+    Returns the erased object (or NULL if the key doesn't exist).
+*/
+void* fm_any_erase(FlatMap* map, void* key, size_t key_size) {
+    FlatSlot* slot = flat_probe(map, key, key_size, flat_hash(key, key_size));
+    if (slot->hash == 0) {
+        return NULL;
+    }
+    void* data = slot->data;
+    if (slot->key_size > FLAT_INLINE_KEY) {
+        map->keys_erased += slot->key_size;
+    }
+
+    // shift later elements of the probe run back into the hole, so no tombstone is needed
+    size_t mask = map->capacity - 1;
+    size_t hole = slot - map->slots;
+    size_t index = hole;
+    while (1) {
+        index = (index + 1) & mask;
+        FlatSlot* next = &map->slots[index];
+        if (next->hash == 0) break;
+
+        // move it back only if its home slot isn't between the hole and where it is now
+        size_t home = next->hash & mask;
+        int home_after_hole = (hole <= index)? (hole < home && home <= index) : (hole < home || home <= index);
+        if (!home_after_hole) {
+            map->slots[hole] = *next;
+            hole = index;
+        }
+    }
+    memset(&map->slots[hole], 0, sizeof(FlatSlot));
+    --map->len;
+
+    return data;
+}
+
+/*
+    Function to erase an object in the map, using an int as the key.
+*/
+void* fm_int_erase(FlatMap* map, int key) {
+    return fm_any_erase(map, &key, sizeof(key));
+}
+
+/*
+    Function to erase an object in the map, using an string as the key.
+*/
+void* fm_erase(FlatMap* map, char* key) {
+    return fm_any_erase(map, key, (strlen(key) + 1) * sizeof(char));
+}
+
+/*
+    Function to determine if an object is in the map, with any other object used as the key.
+*/
+int fm_any_contains(FlatMap* map, void* key, size_t key_size) {
+    return flat_probe(map, key, key_size, flat_hash(key, key_size))->hash != 0;
+}
+
+int fm_int_contains(FlatMap* map, int key) {
+    return fm_any_contains(map, &key, sizeof(key));
+}
+
+int fm_contains(FlatMap* map, char* key) {
+    return fm_any_contains(map, key, (strlen(key) + 1) * sizeof(char));
+}
+
+/*
+    Returns the elements in the map, useful for iterating. 
+
+    Keys point into the map, so they're only valid until the map is next changed. Free the
+    returned array when done (not the keys).
+*/
+Element* flat_map_elements(FlatMap* map) {
+    Element* array = malloc((map->len + 1) * sizeof(Element));
+
+    int l = 0;
+    for (size_t i = 0; i < map->capacity; ++i) {
+        FlatSlot* slot = &map->slots[i];
+        if (slot->hash != 0) {
+            array[l].key = (char*)flat_slot_key(map, slot);
+            array[l].key_size = slot->key_size;
+            array[l].data = slot->data;
+            ++l;
+        }
+    }
+
+    return array;
+}
+
+/*
+    Bytes of memory the map uses itself (not counting the objects in it)
+*/
+size_t flat_map_bytes(FlatMap* map) {
+    return sizeof(FlatMap) + map->capacity * sizeof(FlatSlot) + map->keys_capacity;
+}
+
+/*
+    Bytes of memory the map uses itself (not counting the objects in it). Approximate, as each
+    element and key is its own allocation.
+*/
+size_t map_bytes(Map* map) {
+    size_t bytes = sizeof(Map) + map->data_size * sizeof(Element*);
+    for (size_t i = 0; i < map->data_size; ++i) {
+        if (map->data[i] != NULL) {
+            bytes += sizeof(Element) + map->data[i]->key_size + 2 * sizeof(size_t); // plus malloc headers
+        }
+    }
+    return bytes;
+}
+
+
+/*
+    A map that can be shared between threads, for caches that are read far more than they're
+    written. Keys are 64 bit integers (pack whatever ids you need into them) and values are
+    non NULL pointers.
+
+    Used like so:
+    ```
+    ConcurrentMap* map = new_concurrent_map();
+
+    // from any thread
+    MyStruct* object = cm_get(map, 12);
+    if (object == NULL) {
+        object = cm_get_or_create(map, 12, create_my_struct, context);
+    }
+
+    free_concurrent_map(map);
+    ```
+
+    Like the other maps it doesn't free any items placed in it.
+
+
+
+    # DESIGN
+
+    The map is split into CONCURRENT_SHARDS independent tables, picked by the top bits of the
+    key's hash. Each shard is a linear probing table like FlatMap, with a mutex for writers and a
+    sequence counter for readers.
+
+    Readers never lock. They read the sequence, search the table, then read the sequence again,
+    and retry if a writer was active in between (odd sequence) or finished one (changed sequence).
+    Writers only bump the sequence around the few stores that change the table, so readers are
+    almost never retried.
+
+    When a shard grows, the old table isn't freed until the map is, since a reader may still be
+    searching it. Growth doubles the table, so the retired tables add up to less than the live one.
+
+    'cm_get_or_create' holds the shard's writer lock while creating the value, so a value is only
+    ever created once. Other shards, and readers of the same shard, carry on in the meantime.
+
+*/
+
+#define CONCURRENT_SHARD_BITS 6
+#define CONCURRENT_SHARDS (1 << CONCURRENT_SHARD_BITS)
+
+typedef struct {
+    _Atomic uint64_t key;
+    _Atomic(void*) data; // NULL means the slot is empty
+} ConcurrentSlot;
+
+typedef struct ConcurrentTable {
+    ConcurrentSlot* slots;
+    size_t capacity; // always a power of two
+    struct ConcurrentTable* retired; // older, smaller tables that readers may still be using
+} ConcurrentTable;
+
+typedef struct {
+    pthread_mutex_t lock; // held by writers
+    atomic_uint sequence; // odd while a writer is changing the table
+    _Atomic(ConcurrentTable*) table;
+    size_t len;
+#ifdef MAP_STATS
+    MapStats stats;
+#endif
+} ConcurrentShard;
+
+typedef struct ConcurrentMap {
+    ConcurrentShard shards[CONCURRENT_SHARDS];
+} ConcurrentMap;
+
+#define CONCURRENT_MIN_CAPACITY 16
+
+
+static uint64_t concurrent_hash(uint64_t key) {
+    // murmur3 finalizer
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static ConcurrentTable* new_concurrent_table(size_t capacity) {
+    ConcurrentTable* table = malloc(sizeof(ConcurrentTable));
+    if (table == NULL) {
+        map_mem_error_exit_failing();
+    }
+    table->slots = calloc(capacity, sizeof(ConcurrentSlot));
+    if (table->slots == NULL) {
+        map_mem_error_exit_failing();
+    }
+    table->capacity = capacity;
+    table->retired = NULL;
+    return table;
+}
+
+/*
+    Creates an empty concurrent map
+*/
+ConcurrentMap* new_concurrent_map() {
+    ConcurrentMap* map = malloc(sizeof(ConcurrentMap));
+    if (map == NULL) {
+        map_mem_error_exit_failing();
+    }
+    for (int i = 0; i < CONCURRENT_SHARDS; i++) {
+        ConcurrentShard* shard = &map->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        atomic_init(&shard->sequence, 0);
+        atomic_init(&shard->table, new_concurrent_table(CONCURRENT_MIN_CAPACITY));
+        shard->len = 0;
+#ifdef MAP_STATS
+        memset(&shard->stats, 0, sizeof(MapStats));
+#endif
+    }
+    return map;
+}
+
+/*
+    Frees the map's own memory. No other thread may be using the map.
+*/
+void free_concurrent_map(ConcurrentMap* map) {
+    for (int i = 0; i < CONCURRENT_SHARDS; i++) {
+        ConcurrentShard* shard = &map->shards[i];
+        ConcurrentTable* table = atomic_load(&shard->table);
+        while (table != NULL) {
+            ConcurrentTable* retired = table->retired;
+            free(table->slots);
+            free(table);
+            table = retired;
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(map);
+}
+
+static void* concurrent_table_find(ConcurrentShard* shard, ConcurrentTable* table, uint64_t key, uint64_t hash) {
+    (void)shard; // only used for stats
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    for (size_t probes = 0;; probes++) {
+        ConcurrentSlot* slot = &table->slots[index];
+        void* data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+        if (data == NULL || atomic_load_explicit(&slot->key, memory_order_relaxed) == key) {
+#ifdef MAP_STATS
+            map_stats_record_probe(&shard->stats, probes);
+#endif
+            return data;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+// writes into an empty slot, only for tables readers can't see or inside a sequence write
+static void concurrent_table_insert(ConcurrentTable* table, uint64_t key, uint64_t hash, void* data) {
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    while (atomic_load_explicit(&table->slots[index].data, memory_order_relaxed) != NULL) {
+        index = (index + 1) & mask;
+    }
+    atomic_store_explicit(&table->slots[index].key, key, memory_order_relaxed);
+    atomic_store_explicit(&table->slots[index].data, data, memory_order_relaxed);
+}
+
+static void concurrent_write_begin(ConcurrentShard* shard) {
+    unsigned sequence = atomic_load_explicit(&shard->sequence, memory_order_relaxed);
+    atomic_store_explicit(&shard->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void concurrent_write_end(ConcurrentShard* shard) {
+    unsigned sequence = atomic_load_explicit(&shard->sequence, memory_order_relaxed);
+    atomic_store_explicit(&shard->sequence, sequence + 1, memory_order_release);
+}
+
+/*
+    Function to get an object from the map. Safe to call from any thread at any time.
+
+    Returns a NULL pointer if no object exists at the key
+*/
+void* cm_get(ConcurrentMap* map, uint64_t key) {
+    uint64_t hash = concurrent_hash(key);
+    ConcurrentShard* shard = &map->shards[hash >> (64 - CONCURRENT_SHARD_BITS)];
+
+    while (1) {
+        unsigned before = atomic_load_explicit(&shard->sequence, memory_order_acquire);
+        if (before & 1) {
+            continue; // a writer is mid change
+        }
+
+        ConcurrentTable* table = atomic_load_explicit(&shard->table, memory_order_acquire);
+        void* data = concurrent_table_find(shard, table, key, hash);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shard->sequence, memory_order_relaxed) == before) {
+            return data;
+        }
+    }
+}
+
+// call with the shard locked
+static void concurrent_shard_insert(ConcurrentShard* shard, uint64_t key, uint64_t hash, void* data) {
+    ConcurrentTable* table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+
+    // grow into a new table first, readers keep using the old one until it's published
+    if ((shard->len + 1) * 4 > table->capacity * 3) {
+#ifdef MAP_STATS
+        double start = map_stats_now();
+#endif
+        ConcurrentTable* grown = new_concurrent_table(table->capacity * 2);
+        for (size_t i = 0; i < table->capacity; i++) {
+            void* old_data = atomic_load_explicit(&table->slots[i].data, memory_order_relaxed);
+            if (old_data != NULL) {
+                uint64_t old_key = atomic_load_explicit(&table->slots[i].key, memory_order_relaxed);
+                concurrent_table_insert(grown, old_key, concurrent_hash(old_key), old_data);
+            }
+        }
+        concurrent_table_insert(grown, key, hash, data);
+        grown->retired = table;
+
+        concurrent_write_begin(shard);
+        atomic_store_explicit(&shard->table, grown, memory_order_release);
+        concurrent_write_end(shard);
+#ifdef MAP_STATS
+        shard->stats.resizes++;
+        shard->stats.rehash_seconds += map_stats_now() - start;
+#endif
+    }
+    else {
+        concurrent_write_begin(shard);
+        concurrent_table_insert(table, key, hash, data);
+        concurrent_write_end(shard);
+    }
+    ++shard->len;
+}
+
+/*
+    Function to insert an object in the map if the key isn't already used.
+    Returns the object now in the map, which is 'data' unless another thread got there first.
+*/
+void* cm_put_if_absent(ConcurrentMap* map, uint64_t key, void* data) {
+    uint64_t hash = concurrent_hash(key);
+    ConcurrentShard* shard = &map->shards[hash >> (64 - CONCURRENT_SHARD_BITS)];
+
+    pthread_mutex_lock(&shard->lock);
+    void* existing = concurrent_table_find(shard, atomic_load_explicit(&shard->table, memory_order_relaxed), key, hash);
+    if (existing == NULL) {
+        concurrent_shard_insert(shard, key, hash, data);
+        existing = data;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return existing;
+}
+
+/*
+    Function to get an object from the map, calling 'create(key, context)' to make it if it
+    doesn't exist yet. 'create' runs at most once per key, even when several threads ask for the
+    same key at the same time (the others wait for it). If 'create' returns NULL nothing is stored.
+*/
+void* cm_get_or_create(ConcurrentMap* map, uint64_t key, void* (*create)(uint64_t key, void* context), void* context) {
+    void* data = cm_get(map, key);
+    if (data != NULL) {
+        return data;
+    }
+
+    uint64_t hash = concurrent_hash(key);
+    ConcurrentShard* shard = &map->shards[hash >> (64 - CONCURRENT_SHARD_BITS)];
+
+    pthread_mutex_lock(&shard->lock);
+    data = concurrent_table_find(shard, atomic_load_explicit(&shard->table, memory_order_relaxed), key, hash);
+    if (data == NULL) {
+        data = create(key, context);
+        if (data != NULL) {
+            concurrent_shard_insert(shard, key, hash, data);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return data;
+}
+
+/*
+    Number of objects in the map. Only exact when no other thread is writing.
+*/
+size_t concurrent_map_len(ConcurrentMap* map) {
+    size_t len = 0;
+    for (int i = 0; i < CONCURRENT_SHARDS; i++) {
+        pthread_mutex_lock(&map->shards[i].lock);
+        len += map->shards[i].len;
+        pthread_mutex_unlock(&map->shards[i].lock);
+    }
+    return len;
+}
+
+/*
+    Prints the map's size, load factor and memory, plus its counters when compiled with MAP_STATS
+*/
+void print_map_stats(const char* name, Map* map) {
+    MapStats* stats = NULL;
+#ifdef MAP_STATS
+    stats = &map->stats;
+#endif
+    print_stats(name, stats, map->len, map->data_size, map_bytes(map));
+}
+
+void print_flat_map_stats(const char* name, FlatMap* map) {
+    MapStats* stats = NULL;
+#ifdef MAP_STATS
+    stats = &map->stats;
+#endif
+    print_stats(name, stats, map->len, map->capacity, flat_map_bytes(map));
+}
+
+/*
+    Adds up the shards. Call when no other thread is writing.
+*/
+void print_concurrent_map_stats(const char* name, ConcurrentMap* map) {
+    size_t len = 0;
+    size_t capacity = 0;
+    size_t bytes = sizeof(ConcurrentMap);
+    MapStats total;
+    memset(&total, 0, sizeof(MapStats));
+
+    for (int i = 0; i < CONCURRENT_SHARDS; i++) {
+        ConcurrentShard* shard = &map->shards[i];
+        len += shard->len;
+        ConcurrentTable* table = atomic_load(&shard->table);
+        capacity += table->capacity;
+        for (; table != NULL; table = table->retired) {
+            bytes += sizeof(ConcurrentTable) + table->capacity * sizeof(ConcurrentSlot);
+        }
+
+#ifdef MAP_STATS
+        total.operations += shard->stats.operations;
+        for (int b = 0; b < MAP_STATS_PROBE_BUCKETS; b++) {
+            total.probe_histogram[b] += shard->stats.probe_histogram[b];
+        }
+        if (shard->stats.max_probe > total.max_probe) total.max_probe = shard->stats.max_probe;
+        total.resizes += shard->stats.resizes;
+        total.rehash_seconds += shard->stats.rehash_seconds;
+#endif
+    }
+
+    MapStats* stats = NULL;
+#ifdef MAP_STATS
+    stats = &total;
+#endif
+    print_stats(name, stats, len, capacity, bytes);
+}
+
+#endif
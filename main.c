@@ -4,6 +4,9 @@
 #include <string.h>
 #include <math.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdarg.h>
 #define NBT_IMPLEMENTATION
 #include "dependencies/nbt.h"  // Make sure nbt.h is in your include path
 #include "dependencies/Map.h"
@@ -21,13 +24,34 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+#if !defined(NO_SIMD) && (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#elif !defined(NO_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
 #endif
 
 
 #define SECTION_SIZE 16
 #define BLOCKS_PER_SECTION (SECTION_SIZE*SECTION_SIZE*SECTION_SIZE)
 
-char* ANGLE = "SW";
+/**
+ * Viewing angles. Each value is also the side of a rendered block that faces the viewer from that
+ * angle (see 'apply_side_rotation'), so sprites and per angle code are picked by indexing with it.
+ */
+typedef enum {
+    ANGLE_SW,
+    ANGLE_NW,
+    ANGLE_NE,
+    ANGLE_SE,
+    ANGLE_COUNT
+} Angle;
+
+char* ANGLE_NAMES[ANGLE_COUNT] = {"SW", "NW", "NE", "SE"};
+Angle ANGLE = ANGLE_SW;
 
 char* RESET = "\033[0m";
 char* RED = "\033[252;3;3m";
@@ -35,6 +59,9 @@ char* YELLOW = "\033[252;186;3m";
 
 #define IMAGE_SIZE 1024
 
+// bump when anything written to the asset cache changes format
+#define MAPPER_VERSION 2
+
 
 // DUMPERS
 
@@ -98,19 +125,31 @@ void dump_compound(nbt_tag_t *compound, int indent) {
 }
 
 
-// Helper to read a bitfield from the packed long array
-static inline uint64_t get_bits(uint64_t *data, size_t bit_index, size_t bits_per_block, size_t data_len) {
-    size_t start_long = bit_index / 64;
-    size_t start_bit = bit_index % 64;
-    uint64_t val = data[start_long] >> start_bit;
-
-    // Check if the value spans two longs
-    if (start_bit + bits_per_block > 64 && start_long + 1 < data_len) {
-        val |= data[start_long + 1] << (64 - start_bit);
+/**
+ * Unpacks 'count' palette indices of 'bits_per_entry' bits from a packed long array.
+ *
+ * Since 1.16 entries never span two longs, the leftover high bits of each long are padding.
+ */
+static void unpack_palette_indices(const int64_t *data, size_t data_len, int bits_per_entry, int count, uint16_t *out) {
+    int values_per_long = 64 / bits_per_entry;
+    uint64_t mask = (1ULL << bits_per_entry) - 1;
+
+    int i = 0;
+    for (size_t l = 0; l < data_len && i < count; l++) {
+        uint64_t value = (uint64_t)data[l];
+        for (int v = 0; v < values_per_long && i < count; v++) {
+            out[i++] = (uint16_t)(value & mask);
+            value >>= bits_per_entry;
+        }
     }
+    while (i < count) out[i++] = 0;
+}
 
-    uint64_t mask = (1ULL << bits_per_block) - 1;
-    return val & mask;
+// bits needed to index a palette of the given size
+static int palette_bits(size_t palette_size) {
+    int bits = 0;
+    while (((size_t)1 << bits) < palette_size) bits++;
+    return bits;
 }
 
 void make_dirs(const char *path) {
@@ -127,25 +166,28 @@ void make_dirs(const char *path) {
 }
 
 // Decode BlockStates long array into 16x16x16 palette indices
-void decode_block_states(int64_t *data, size_t data_len, size_t palette_size, uint8_t out[SECTION_SIZE][SECTION_SIZE][SECTION_SIZE]) {
+void decode_block_states(int64_t *data, size_t data_len, size_t palette_size, uint16_t out[SECTION_SIZE][SECTION_SIZE][SECTION_SIZE]) {
     if (palette_size == 0 || !data) return;
 
-    size_t bits_per_block = (size_t)ceil(log2(palette_size));
-    if (bits_per_block < 1) bits_per_block = 1; // minimum 1 bit
+    int bits_per_block = palette_bits(palette_size);
+    if (bits_per_block < 4) bits_per_block = 4; // block states always use at least 4 bits
+
+    uint16_t indices[BLOCKS_PER_SECTION];
+    unpack_palette_indices(data, data_len, bits_per_block, BLOCKS_PER_SECTION, indices);
 
     for (size_t i = 0; i < BLOCKS_PER_SECTION; i++) {
-        uint64_t idx = get_bits((uint64_t*)data, i * bits_per_block, bits_per_block, data_len);
+        uint16_t idx = indices[i];
         if (idx >= palette_size) idx = 0; // safety check
         // Convert linear index to 3D coords
         size_t y = i / (SECTION_SIZE*SECTION_SIZE);
         size_t z = (i / SECTION_SIZE) % SECTION_SIZE;
         size_t x = i % SECTION_SIZE;
-        out[x][y][z] = (uint8_t)idx;
+        out[x][y][z] = idx;
     }
 }
 
 // Print a 16x16x16 section using the palette names
-void print_section_palette_names(uint8_t blocks[16][16][16], nbt_tag_t *palette) {
+void print_section_palette_names(uint16_t blocks[16][16][16], nbt_tag_t *palette) {
     if (!palette) return;
 
     printf("Section printout:\n");
@@ -153,7 +195,7 @@ void print_section_palette_names(uint8_t blocks[16][16][16], nbt_tag_t *palette)
         printf("Y=%zu:\n", y);
         for (size_t z = 0; z < 16; z++) {
             for (size_t x = 0; x < 16; x++) {
-                uint8_t idx = blocks[x][y][z];
+                uint16_t idx = blocks[x][y][z];
                 nbt_tag_t *block_tag = nbt_tag_list_get(palette, idx);
                 nbt_tag_t *name_tag = nbt_tag_compound_get(block_tag, "Name");
                 const char *name = name_tag ? name_tag->tag_string.value : "unknown";
@@ -167,7 +209,7 @@ void print_section_palette_names(uint8_t blocks[16][16][16], nbt_tag_t *palette)
 }
 
 // Print a 16x16x16 section using the palette names (full names)
-void print_section(uint8_t blocks[16][16][16], nbt_tag_t *palette) {
+void print_section(uint16_t blocks[16][16][16], nbt_tag_t *palette) {
     if (!palette) return;
 
     printf("Section printout:\n");
@@ -175,7 +217,7 @@ void print_section(uint8_t blocks[16][16][16], nbt_tag_t *palette) {
         printf("Y=%zu:\n", y);
         for (size_t z = 0; z < 16; z++) {
             for (size_t x = 0; x < 16; x++) {
-                uint8_t idx = blocks[x][y][z];
+                uint16_t idx = blocks[x][y][z];
                 nbt_tag_t *block_tag = nbt_tag_list_get(palette, idx);
                 nbt_tag_t *name_tag = block_tag ? nbt_tag_compound_get(block_tag, "Name") : NULL;
                 const char *name = name_tag ? name_tag->tag_string.value : "unknown";
@@ -189,7 +231,7 @@ void print_section(uint8_t blocks[16][16][16], nbt_tag_t *palette) {
     }
 }
 
-void print_section_to_file(uint8_t blocks[16][16][16], nbt_tag_t *palette, const char *filename) {
+void print_section_to_file(uint16_t blocks[16][16][16], nbt_tag_t *palette, const char *filename) {
     if (!palette) return;
 
     FILE *fp = fopen(filename, "w");
@@ -203,7 +245,7 @@ void print_section_to_file(uint8_t blocks[16][16][16], nbt_tag_t *palette, const
         fprintf(fp, "Y=%zu:\n", y);
         for (size_t z = 0; z < 16; z++) {
             for (size_t x = 0; x < 16; x++) {
-                uint8_t idx = blocks[x][y][z];
+                uint16_t idx = blocks[x][y][z];
                 nbt_tag_t *block_tag = nbt_tag_list_get(palette, idx);
                 nbt_tag_t *name_tag = block_tag ? nbt_tag_compound_get(block_tag, "Name") : NULL;
                 const char *name = name_tag ? name_tag->tag_string.value : "unknown";
@@ -356,7 +398,7 @@ int print_region_to_file(const char *region_file_path, const char *file_name) {
             nbt_tag_t *data = nbt_tag_compound_get(bs, "data");
 
             if (data) {
-                uint8_t blocks[16][16][16];
+                uint16_t blocks[16][16][16];
                 decode_block_states(data->tag_long_array.value, data->tag_long_array.size, palette->tag_list.size, blocks);
 
                 // blocks[x][y][z] now contains palette indices
@@ -709,14 +751,15 @@ char** split(char* str, char* delim, int* count) {
     char** splits = malloc(2*sizeof(char*));
     int array_size = 2;
     
-    char *token = strtok(strn, delim);
+    char* save;
+    char *token = strtok_r(strn, delim, &save);
     while (token != NULL) {
         
         resize_if_needed(&splits, *count+1, &array_size, sizeof(char*));
 
         splits[*count] = strdup(token);
         (*count)++;
-        token = strtok(NULL, delim);
+        token = strtok_r(NULL, delim, &save);
     }
     free(strn);
 
@@ -819,12 +862,37 @@ void free_property(Property* property) {
     free(property->value);
 }
 
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+} Pixel;
+
 
 typedef struct {
     uint8_t* pixels_0; // 16x16 pixel image representing a block (side view kind of thing)
     uint8_t* pixels_1;
     uint8_t* pixels_2;
     uint8_t* pixels_3;
+
+    // the TintClass of each pixel of the matching side, NULL when none are tinted
+    uint8_t* tints_0;
+    uint8_t* tints_1;
+    uint8_t* tints_2;
+    uint8_t* tints_3;
+
+    // each side scaled down for zoomed out levels, see 'build_rendered_block_lods'
+    uint8_t* lods_0;
+    uint8_t* lods_1;
+    uint8_t* lods_2;
+    uint8_t* lods_3;
+
+    // tint classes of the scaled down sides, NULL when the side's 'tints' is
+    uint8_t* lod_tints_0;
+    uint8_t* lod_tints_1;
+    uint8_t* lod_tints_2;
+    uint8_t* lod_tints_3;
 } RenderedBlock;
 
 void free_rendered_block(RenderedBlock* block) {
@@ -832,19 +900,390 @@ void free_rendered_block(RenderedBlock* block) {
     free(block->pixels_1);
     free(block->pixels_2);
     free(block->pixels_3);
+    free(block->tints_0);
+    free(block->tints_1);
+    free(block->tints_2);
+    free(block->tints_3);
+    free(block->lods_0);
+    free(block->lods_1);
+    free(block->lods_2);
+    free(block->lods_3);
+    free(block->lod_tints_0);
+    free(block->lod_tints_1);
+    free(block->lod_tints_2);
+    free(block->lod_tints_3);
     free(block);
 }
 
 
 
+// REGISTRIES
+
+/**
+ * Hands out dense ids (0, 1, 2, ...) for strings so hot code can key on integers
+ * instead of re-hashing names. Names are copied and live for the whole run.
+ */
+typedef struct {
+    Map* name_to_id; // values are 'id + 1' stored in the pointer so NULL still means missing
+    char** names;
+    int len;
+    int capacity;
+} Interner;
+
+// 'expected_len' sizes the interner up front so it won't need to grow in the usual case
+Interner* new_interner(int expected_len) {
+    Interner* interner = malloc(sizeof(Interner));
+    interner->name_to_id = new_map_reserved(expected_len);
+    interner->capacity = expected_len;
+    interner->names = malloc(interner->capacity * sizeof(char*));
+    interner->len = 0;
+    return interner;
+}
+
+/**
+ * Returns the id for the name, adding it if it hasn't been seen yet.
+ */
+uint32_t intern(Interner* interner, const char* name) {
+    void* found = m_get(interner->name_to_id, (char*)name);
+    if (found != NULL) {
+        return (uint32_t)((uintptr_t)found - 1);
+    }
+
+    resize_if_needed((void***)&interner->names, interner->len, &interner->capacity, sizeof(char*));
+    uint32_t id = interner->len;
+    interner->names[id] = strdup(name);
+    m_unique(interner->name_to_id, interner->names[id], (void*)(uintptr_t)(id + 1));
+    interner->len++;
+
+    return id;
+}
+
+char* interned_name(Interner* interner, uint32_t id) {
+    return interner->names[id];
+}
+
+
+/**
+ * A block name plus all of its properties, like 'minecraft:oak_stairs[facing=east,half=bottom,...]'.
+ *
+ * Every distinct combination seen in the world gets one of these and a dense id. The
+ * common rotation properties are pulled out for convenience (NULL when the block doesn't have them).
+ */
+typedef struct {
+    uint32_t id;
+    char* key; // canonical 'name[prop=value,...]' string, properties sorted by name
+    char* name;
+
+    Property* properties;
+    int property_count;
+
+    // rotations (point into 'properties')
+    char* axis; // logs/quartz piller
+    char* facing; // stairs and doors direction NESW
+    char* half; // stairs top or bottom
+    char* shape; // stair modifiers
+    char* type; // slab top or bottom
+    char* rotation; // 0-3 rotation for other blocks
+
+    int is_air;
+    int is_transparent; // blocks under it can be seen (water, glass, leaves, slabs, plants...)
+
+    struct StateModel* model; // what to draw, set the first time it's drawn (see 'get_state_model')
+} BlockState;
+
+Interner* BLOCK_STATE_KEYS = NULL;
+BlockState** BLOCK_STATES = NULL; // id -> block state
+int BLOCK_STATES_CAPACITY = 0;
+
+Interner* BIOME_NAMES = NULL;
+
+void init_registries() {
+    BLOCK_STATE_KEYS = new_interner(1024); // a world usually uses a few hundred to a few thousand states
+    BLOCK_STATES_CAPACITY = 1024;
+    BLOCK_STATES = malloc(BLOCK_STATES_CAPACITY * sizeof(BlockState*));
+    BIOME_NAMES = new_interner(128); // vanilla has about 65 biomes
+}
+
+int compare_properties(const void *a, const void *b) {
+    return strcmp(((Property*)a)->key, ((Property*)b)->key);
+}
+
+int is_air_block(const char* block_minecraft_name) {
+    return strcmp(block_minecraft_name, "minecraft:air") == 0
+        || strcmp(block_minecraft_name, "minecraft:cave_air") == 0
+        || strcmp(block_minecraft_name, "minecraft:void_air") == 0;
+}
+
+// parts of block names that don't fill their whole block or can be seen through
+const char* TRANSPARENT_NAME_PARTS[] = {
+    "water", "glass", "leaves", "ice", "_slab", "_stairs", "_fence", "_wall", "_door", "_trapdoor", "carpet",
+    "bars", "chain", "lantern", "torch", "rail", "_button", "_sign", "_bed", "_head", "_skull",
+    "cobweb", "vine", "lichen", "grass", "fern", "bush", "flower", "sapling", "_roots", "dripleaf", "azalea",
+    "kelp", "seagrass", "sugar_cane", "bamboo", "lily", "dandelion", "poppy", "orchid", "allium", "tulip", "daisy",
+    "cornflower", "peony", "lilac", "_bud", "amethyst_cluster", "spore_blossom", "leaf_litter", "bubble_column",
+    "mushroom", "coral", "pickle", "candle", "ladder", "lever", "redstone_wire", "_plate", "scaffolding",
+    "wheat", "carrots", "potatoes", "beetroots", "nether_wart", "melon_stem", "pumpkin_stem", "cocoa", "sweet_berry",
+    "pitcher", "cactus", "petals", "wildflowers", "flower_pot", "potted_", "end_rod", "lightning_rod",
+    "pointed_dripstone", "tripwire", "_pane", "repeater", "comparator", "daylight_detector", "campfire", "egg",
+    "frogspawn", "sculk_vein",
+};
+
+// names that match the list above but are still full opaque blocks (the whole name, or the part all of them share)
+const char* OPAQUE_NAME_PARTS[] = {
+    "grass_block", "packed_ice", "blue_ice", "mushroom_block", "mushroom_stem", "tinted_glass", "sea_lantern",
+    "coral_block", "bamboo_block", "bamboo_planks", "bamboo_mosaic", "minecraft:jack_o_lantern",
+    "minecraft:chain_command_block", "minecraft:muddy_mangrove_roots", "minecraft:dried_kelp_block",
+    "minecraft:nether_wart_block",
+};
+
+int is_transparent_block(const char* block_minecraft_name, const char* slab_type) {
+    if (strcmp(block_minecraft_name, "minecraft:snow") == 0) return 1; // snow layers, not 'snow_block'
+    if (slab_type != NULL && strcmp(slab_type, "double") == 0) return 0;
+
+    for (size_t i = 0; i < len(OPAQUE_NAME_PARTS); i++) {
+        if (strstr(block_minecraft_name, OPAQUE_NAME_PARTS[i])) return 0;
+    }
+    for (size_t i = 0; i < len(TRANSPARENT_NAME_PARTS); i++) {
+        if (strstr(block_minecraft_name, TRANSPARENT_NAME_PARTS[i])) return 1;
+    }
+    return 0;
+}
+
+static char* find_property(BlockState* state, const char* key) {
+    for (int i = 0; i < state->property_count; i++) {
+        if (strcmp(state->properties[i].key, key) == 0) return state->properties[i].value;
+    }
+    return NULL;
+}
+
+/**
+ * Returns the id of the block state described by a section palette entry ({Name, Properties}).
+ *
+ * Call this once per palette entry, not once per block.
+ */
+uint32_t block_state_id(nbt_tag_t* block_tag) {
+    nbt_tag_t *name_tag = block_tag ? nbt_tag_compound_get(block_tag, "Name") : NULL;
+    const char *name = name_tag ? name_tag->tag_string.value : "unknown";
+
+    // collect string properties sorted by name
+    nbt_tag_t *props = block_tag ? nbt_tag_compound_get(block_tag, "Properties") : NULL;
+    int prop_count = (props && props->type == NBT_TYPE_COMPOUND) ? props->tag_compound.size : 0;
+    Property properties[prop_count + 1];
+    int n = 0;
+    for (int i = 0; i < prop_count; i++) {
+        nbt_tag_t *p = props->tag_compound.value[i];
+        if (p->type == NBT_TYPE_STRING) {
+            properties[n].key = p->name;
+            properties[n].value = p->tag_string.value;
+            n++;
+        }
+    }
+    qsort(properties, n, sizeof(Property), compare_properties);
+
+    // build key, sized from its parts so long property lists are never cut short
+    size_t key_size = strlen(name) + 2; // closing ']' and terminator
+    for (int i = 0; i < n; i++) {
+        key_size += strlen(properties[i].key) + strlen(properties[i].value) + 2; // separator and '='
+    }
+    char key[key_size];
+    size_t len = snprintf(key, key_size, "%s", name);
+    for (int i = 0; i < n; i++) {
+        len += snprintf(key + len, key_size - len, "%c%s=%s", i == 0? '[' : ',', properties[i].key, properties[i].value);
+    }
+    if (n > 0) {
+        len += snprintf(key + len, key_size - len, "]");
+    }
+
+    int known_states = BLOCK_STATE_KEYS->len;
+    uint32_t id = intern(BLOCK_STATE_KEYS, key);
+    if ((int)id < known_states) {
+        return id;
+    }
+
+    // first time seeing this state
+    BlockState* state = calloc(1, sizeof(BlockState));
+    state->id = id;
+    state->key = interned_name(BLOCK_STATE_KEYS, id);
+    state->name = strdup(name);
+    state->property_count = n;
+    state->properties = malloc((n + 1) * sizeof(Property));
+    for (int i = 0; i < n; i++) {
+        state->properties[i].key = strdup(properties[i].key);
+        state->properties[i].value = strdup(properties[i].value);
+    }
+    state->axis = find_property(state, "axis");
+    state->facing = find_property(state, "facing");
+    state->half = find_property(state, "half");
+    state->shape = find_property(state, "shape");
+    state->type = find_property(state, "type");
+    state->rotation = find_property(state, "rotation");
+    state->is_air = is_air_block(name);
+    state->is_transparent = state->is_air || is_transparent_block(name, state->type);
+
+    resize_if_needed((void***)&BLOCK_STATES, id, &BLOCK_STATES_CAPACITY, sizeof(BlockState*));
+    BLOCK_STATES[id] = state;
+
+    return id;
+}
+
+BlockState* get_block_state(uint32_t id) {
+    return BLOCK_STATES[id];
+}
+
+// ids past the last one that fits are all treated as an unknown biome (see 'get_biome')
+uint16_t biome_id(const char* biome_name) {
+    uint32_t id = intern(BIOME_NAMES, biome_name);
+    return id < UINT16_MAX? (uint16_t)id : UINT16_MAX;
+}
+
+char* biome_name(uint16_t id) {
+    return interned_name(BIOME_NAMES, id);
+}
+
+
+
 // UTILITY METHODS
 
-int extract_jar(const char *jar_path, const char *out_dir) {
-    
-    if (mkdir(out_dir, 0755) != 0) {
-        perror("mkdir failed");
+// number of cores to spread work over
+int cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0? (int)count : 1;
+#endif
+}
+
+/**
+ * Maps a whole file into memory read only and sets 'size' to its length. Returns NULL if the
+ * file can't be opened, is empty or can't be mapped. Release it with 'unmap_file'.
+ */
+uint8_t* map_file(const char* path, size_t* size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        return NULL;
+    }
+    uint8_t* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // the view keeps the mapping open
+    if (data == NULL) {
+        return NULL;
+    }
+    *size = (size_t)file_size.QuadPart;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    uint8_t* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+void unmap_file(uint8_t* data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// cuts a file down to 'size' bytes, returns 0 if it worked. Windows won't cut a mapped file.
+int truncate_file(const char* path, size_t size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+    int cut = SetFilePointerEx(file, end, NULL, FILE_BEGIN) && SetEndOfFile(file);
+    CloseHandle(file);
+    return cut? 0 : -1;
+#else
+    return truncate(path, size);
+#endif
+}
+
+typedef struct {
+    int index; // in the jar
+    size_t compressed_size;
+} JarEntry;
+
+typedef struct {
+    const char* jar_path;
+    const char* out_dir;
+    JarEntry* entries;
+    int count;
+    int failures;
+} ExtractJob;
+
+int compare_jar_entries_largest_first(const void* a, const void* b) {
+    size_t size_a = ((JarEntry*)a)->compressed_size;
+    size_t size_b = ((JarEntry*)b)->compressed_size;
+    return (size_a < size_b) - (size_a > size_b);
+}
+
+// extracts one thread's share of the jar with its own reader, miniz readers can't be shared
+void* extract_jar_entries(void* arg) {
+    ExtractJob* job = arg;
+
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(zip));
+    if (!mz_zip_reader_init_file(&zip, job->jar_path, 0)) {
+        printf("Failed to open jar: %s\n", job->jar_path);
+        job->failures = job->count;
+        return NULL;
+    }
+
+    for (int i = 0; i < job->count; i++) {
+        char name[1024];
+        mz_zip_reader_get_filename(&zip, job->entries[i].index, name, sizeof(name));
+
+        char out_path[2048];
+        snprintf(out_path, sizeof(out_path), "%s/%s", job->out_dir, name);
+        if (!mz_zip_reader_extract_to_file(&zip, job->entries[i].index, out_path, 0)) {
+            printf("Failed to extract %s\n", name);
+            job->failures++;
+        }
     }
 
+    mz_zip_reader_end(&zip);
+    return NULL;
+}
+
+/**
+ * Extracts the jar's .json and .png files to 'out_dir', spread across a thread per core.
+ *
+ * Each thread gets about the same number of compressed bytes (largest entries are handed out
+ * first, each to the thread with the least so far). The directories are all created before
+ * any thread starts, once each.
+ */
+int extract_jar(const char *jar_path, const char *out_dir) {
 
     mz_zip_archive zip;
     memset(&zip, 0, sizeof(zip));
@@ -857,6 +1296,10 @@ int extract_jar(const char *jar_path, const char *out_dir) {
     int file_count = (int)mz_zip_reader_get_num_files(&zip);
     printf("Archive has %d files\n", file_count);
 
+    // COLLECT ENTRIES AND THEIR DIRECTORIES
+    JarEntry* entries = malloc(file_count * sizeof(JarEntry));
+    int entry_count = 0;
+    Map* dirs = new_map();
     for (int i = 0; i < file_count; i++) {
         mz_zip_archive_file_stat stat;
         if (!mz_zip_reader_file_stat(&zip, i, &stat)) {
@@ -866,26 +1309,87 @@ int extract_jar(const char *jar_path, const char *out_dir) {
 
         const char *name = stat.m_filename;
 
-        // Only extract block textures
-        if (strstr(name, ".json") || strstr(name, ".png")) {
-
-            // printf("Extracting %s...\n", name);
+        // Only extract models, textures and data
+        if (!strstr(name, ".json") && !strstr(name, ".png")) continue;
 
-            // Build output path
-            char out_path[1024];
-            snprintf(out_path, sizeof(out_path), "%s/%s", out_dir, name);
+        entries[entry_count].index = i;
+        entries[entry_count].compressed_size = (size_t)stat.m_comp_size;
+        entry_count++;
 
-            make_dirs(out_path);
+        char dir[1024];
+        snprintf(dir, sizeof(dir), "%s", name);
+        char* slash = strrchr(dir, '/');
+        if (slash != NULL) {
+            slash[1] = '\0';
+            if (!m_contains(dirs, dir)) {
+                m_unique(dirs, dir, NULL);
 
-            if (!mz_zip_reader_extract_to_file(&zip, i, out_path, 0)) {
-                printf("Failed to extract %s\n", name);
+                char dir_path[2048];
+                snprintf(dir_path, sizeof(dir_path), "%s/%s", out_dir, dir);
+                make_dirs(dir_path);
             }
         }
     }
-
+    free_map(dirs);
     mz_zip_reader_end(&zip);
 
-    return 0;
+    char dir_path[1024];
+    snprintf(dir_path, sizeof(dir_path), "%s/", out_dir);
+    make_dirs(dir_path);
+
+
+    // SPLIT ENTRIES BETWEEN THREADS
+    int threads = cpu_count();
+    if (threads > entry_count) threads = entry_count > 0? entry_count : 1;
+
+    qsort(entries, entry_count, sizeof(JarEntry), compare_jar_entries_largest_first);
+
+    ExtractJob* jobs = calloc(threads, sizeof(ExtractJob));
+    size_t* job_bytes = calloc(threads, sizeof(size_t));
+    int* owner = malloc(entry_count * sizeof(int));
+    for (int i = 0; i < entry_count; i++) {
+        int smallest = 0;
+        for (int t = 1; t < threads; t++) {
+            if (job_bytes[t] < job_bytes[smallest]) smallest = t;
+        }
+        owner[i] = smallest;
+        job_bytes[smallest] += entries[i].compressed_size;
+        jobs[smallest].count++;
+    }
+
+    JarEntry* grouped = malloc(entry_count * sizeof(JarEntry));
+    int offset = 0;
+    for (int t = 0; t < threads; t++) {
+        jobs[t].jar_path = jar_path;
+        jobs[t].out_dir = out_dir;
+        jobs[t].entries = grouped + offset;
+        int filled = 0;
+        for (int i = 0; i < entry_count; i++) {
+            if (owner[i] == t) jobs[t].entries[filled++] = entries[i];
+        }
+        offset += jobs[t].count;
+    }
+
+
+    // EXTRACT
+    pthread_t* ids = malloc(threads * sizeof(pthread_t));
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&ids[t], NULL, extract_jar_entries, &jobs[t]);
+    }
+    int failures = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        failures += jobs[t].failures;
+    }
+
+    free(ids);
+    free(grouped);
+    free(owner);
+    free(job_bytes);
+    free(jobs);
+    free(entries);
+
+    return failures == 0? 0 : 1;
 }
 
 int is_regular_file(const char *dir, const char *name) {
@@ -1061,62 +1565,6 @@ void extract_mca_region_coordinates(const char* mca_path, long long* x, long lon
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
-int compare_mca_paths(const void *a, const void *b) {
-    const char* first = *(const char**)a;
-    const char* second = *(const char**)b;
-
-    long long first_x = 0;
-    long long first_z = 0;
-    long long second_x = 0;
-    long long second_z = 0;
-
-    extract_mca_region_coordinates(first, &first_x, &first_z);
-    extract_mca_region_coordinates(second, &second_x, &second_z);
-
-    
-    if (strcmp(ANGLE, "NE") == 0) { // + +
-        long long max_x = MAX(first_x, second_x);
-        long long max_z = MAX(first_z, second_z);
-        long long max_coor = MAX(max_x, max_z);
-
-        long long dist_first = llabs(max_coor - first_x) + llabs(max_coor - first_z);
-        long long dist_second = llabs(max_coor - second_x) + llabs(max_coor - second_z);
-        return dist_second - dist_first;
-    }
-    else if (strcmp(ANGLE, "SE") == 0) {  // + -
-        long long max_x = MAX(first_x, second_x);
-        long long min_z = MIN(first_z, second_z);
-        long long max_coor = MAX(llabs(max_x), llabs(min_z));
-
-        long long dist_first = llabs(max_coor - first_x) + llabs(-max_coor - first_z);
-        long long dist_second = llabs(max_coor - second_x) + llabs(-max_coor - second_z);
-        return dist_second - dist_first;
-    }
-    else if (strcmp(ANGLE, "SW") == 0) {  // - -
-        long long min_x = MIN(first_x, second_x);
-        long long min_z = MIN(first_z, second_z);
-        long long min_coor = MIN(min_x, min_z);
-
-        long long dist_first = llabs(min_coor - first_x) + llabs(min_coor - first_z);
-        long long dist_second = llabs(min_coor - second_x) + llabs(min_coor - second_z);
-        return dist_second - dist_first;
-
-    }
-    else if (strcmp(ANGLE, "NW") == 0) {  // - +
-        long long min_x = MIN(first_x, second_x);
-        long long max_z = MAX(first_z, second_z);
-        long long max_coor = MAX(llabs(min_x), llabs(max_z));
-
-        long long dist_first = llabs(-max_coor - first_x) + llabs(max_coor - first_z);
-        long long dist_second = llabs(-max_coor - second_x) + llabs(max_coor - second_z);
-        return dist_second - dist_first;
-    }
-    else {
-        printf("'%s' isn't a valid angle.\n", ANGLE);
-        exit(-1);
-    }
-}
-
 char* make_block_tag() {
 
 }
@@ -1232,66 +1680,451 @@ char **collect_folders(const char *path, int *out_count) {
     return dirs;
 }
 
-char* BLOCKS_PATH = "dump/jar/assets/minecraft/models/block/";
-char* TEXTURE_PATH = "dump/jar/assets/minecraft/textures/";
-char* BIOME_PATH = "dump/jar/data/minecraft/worldgen/biome";
-void find_block_models() {
+// ASSETS
 
+/**
+ * The client jar, opened once and read from directly instead of being extracted to disk.
+ *
+ * Entries are found through an in-memory index of the jar's file names and decompressed
+ * when asked for. The jar is mapped into memory so miniz never seeks a shared file handle,
+ * which makes reading entries safe from several threads.
+ */
+typedef struct {
+    mz_zip_archive zip;
+    uint8_t* data; // the mapped jar
+    size_t size;
+    Map* name_to_index; // "assets/minecraft/..." -> jar file index + 1
+    char** names; // jar file index -> name
     int count;
-    char **dirs = collect_folders("dump/jar", &count);
-    for (int i = 0; i < count; i++) {
-        if (ends_with(dirs[i], "models/block")) {
-            printf("%s\n", dirs[i]);
-            BLOCKS_PATH = cat(dirs[i], "/");
+    uint64_t hash; // of every entry's name, crc and size, identifies the jar's contents
+} AssetFS;
+
+AssetFS* ASSETS = NULL;
+
+// paths in the jar
+char* MODELS_PATH = "assets/minecraft/models/";
+char* TEXTURE_PATH = "assets/minecraft/textures/";
+char* BIOME_PATH = "data/minecraft/worldgen/biome/";
+char* BLOCKSTATES_PATH = "assets/minecraft/blockstates/";
+
+/**
+ * Opens the jar and indexes its entries. Returns NULL if the jar can't be read.
+ */
+AssetFS* open_assets(const char* jar_path) {
+    AssetFS* assets = malloc(sizeof(AssetFS));
+    memset(&assets->zip, 0, sizeof(assets->zip));
+
+    assets->size = 0;
+    assets->data = map_file(jar_path, &assets->size);
+    if (assets->data == NULL || !mz_zip_reader_init_mem(&assets->zip, assets->data, assets->size, 0)) {
+        printf("%sFailed to open jar: %s%s\n", RED, jar_path, RESET);
+        if (assets->data != NULL) unmap_file(assets->data, assets->size);
+        free(assets);
+        return NULL;
+    }
+
+    assets->count = (int)mz_zip_reader_get_num_files(&assets->zip);
+    assets->names = malloc(assets->count * sizeof(char*));
+    assets->name_to_index = new_map_reserved(assets->count);
+    assets->hash = 14695981039346656037ULL;
+    for (int i = 0; i < assets->count; i++) {
+        mz_zip_archive_file_stat stat;
+        if (!mz_zip_reader_file_stat(&assets->zip, i, &stat)) {
+            printf("Failed to get file stat for index %d\n", i);
+            assets->names[i] = strdup("");
+            continue;
         }
-        else if (ends_with(dirs[i], "textures")) {
-            printf("%s\n", dirs[i]);
-            TEXTURE_PATH = cat(dirs[i], "/");
+        assets->names[i] = strdup(stat.m_filename);
+        m_unique(assets->name_to_index, assets->names[i], (void*)(uintptr_t)(i + 1));
+
+        // FNV-1a over the central directory, no need to decompress anything
+        uint64_t sizes[2] = {stat.m_crc32, stat.m_uncomp_size};
+        for (const char* c = stat.m_filename; *c; c++) {
+            assets->hash = (assets->hash ^ (uint8_t)*c) * 1099511628211ULL;
+        }
+        for (size_t b = 0; b < sizeof(sizes); b++) {
+            assets->hash = (assets->hash ^ ((uint8_t*)sizes)[b]) * 1099511628211ULL;
         }
-        free(dirs[i]); // free each path
     }
-    free(dirs); // free array
-}
 
-// Converts the x y of a pixel to an index in the array (assumes 4 channel pixels)
-int pixel_index(int x, int y, int image_width) {
-    return (y * image_width + x) * 4;
+    return assets;
 }
 
-// swaps two values
-void swap(int* a, int* b) {
-    int a_i = *a;
-    int b_i = *b;
-    *a = b_i;
-    *b = a_i;
-}
+/**
+ * Decompresses a jar entry into a new buffer (with a '\0' after the data so text can be used
+ * directly). Returns NULL if the entry doesn't exist.
+ */
+char* read_asset(const char* name, size_t* size) {
+    void* found = m_get(ASSETS->name_to_index, (char*)name);
+    if (found == NULL) {
+        return NULL;
+    }
+    int index = (int)((uintptr_t)found - 1);
 
-// get's the value on the oppposite side of the flip value
-void flip(int* a, int flip_value) {
-    int dist = flip_value - *a;
-    *a = flip_value + dist;
+    mz_zip_archive_file_stat stat;
+    if (!mz_zip_reader_file_stat(&ASSETS->zip, index, &stat)) {
+        return NULL;
+    }
+    size_t length = (size_t)stat.m_uncomp_size;
+    char* buffer = malloc(length + 1);
+    if (buffer == NULL) {
+        fprintf(stderr, "Failed allocating %zu bytes for %s. Ran out of memory probably\n", length + 1, name);
+        exit(-1);
+    }
+    if (!mz_zip_reader_extract_to_mem(&ASSETS->zip, index, buffer, length, 0)) {
+        printf("%sFailed to read %s from the jar%s\n", RED, name, RESET);
+        free(buffer);
+        return NULL;
+    }
+    buffer[length] = '\0';
+
+    if (size != NULL) *size = length;
+    return buffer;
 }
 
+/**
+ * Loads a png from the jar as 4 channel pixels. Returns NULL if it doesn't exist.
+ */
+uint8_t* load_png_asset(const char* name, int* width, int* height) {
+    size_t size;
+    char* png = read_asset(name, &size);
+    if (png == NULL) {
+        return NULL;
+    }
 
-typedef struct {
-    char* name;
-    
-    double temperature;
-    double downfall;
+    int n;
+    uint8_t* data = stbi_load_from_memory((uint8_t*)png, (int)size, width, height, &n, 4);
+    free(png);
+    return data;
+}
 
-    int grass_color;
+/**
+ * Names of the jar entries under 'prefix' that end in 'suffix'. Free the array, not the names.
+ */
+char** list_assets(const char* prefix, const char* suffix, int* out_count) {
+    char** names = malloc(ASSETS->count * sizeof(char*));
+    int count = 0;
+    size_t prefix_len = strlen(prefix);
+    for (int i = 0; i < ASSETS->count; i++) {
+        if (strncmp(ASSETS->names[i], prefix, prefix_len) == 0 && ends_with(ASSETS->names[i], suffix)) {
+            names[count++] = ASSETS->names[i];
+        }
+    }
+
+    *out_count = count;
+    return names;
+}
+
+// ASSET CACHE
+
+/**
+ * A directory per jar (by content hash) and mapper version, holding work that only has to be
+ * done once per Minecraft version.
+ *
+ * 'manifest.txt' records which jar and mapper version the directory is for and which parts are
+ * complete. A part is only marked once it's fully written, so an interrupted run just redoes it.
+ */
+typedef struct {
+    char* dir; // '<cache root>/<jar hash>-v<MAPPER_VERSION>'
+    char jar_hash[17];
+    int jar_entries;
+
+    int extracted; // the jar's .json and .png files are in 'dir/jar'
+    int biomes; // parsed biome data is in 'dir/biomes.txt'
+    int render_pack; // every untinted block is rendered into 'dir/render.pack' (see 'RenderPack')
+} AssetCache;
+
+void save_asset_cache(AssetCache* cache) {
+    char path[1024];
+    char tmp_path[1024];
+    snprintf(path, sizeof(path), "%s/manifest.txt", cache->dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/manifest.txt.tmp", cache->dir);
+
+    FILE* fp = fopen(tmp_path, "w");
+    if (!fp) {
+        perror("fopen");
+        return;
+    }
+    fprintf(fp, "mapper_version %d\n", MAPPER_VERSION);
+    fprintf(fp, "jar_hash %s\n", cache->jar_hash);
+    fprintf(fp, "jar_entries %d\n", cache->jar_entries);
+    fprintf(fp, "extracted %d\n", cache->extracted);
+    fprintf(fp, "biomes %d\n", cache->biomes);
+    fprintf(fp, "render_pack %d\n", cache->render_pack);
+    fclose(fp);
+
+    // replace in one step so the manifest is never half written
+    remove(path);
+    if (rename(tmp_path, path) != 0) {
+        perror("rename");
+    }
+}
+
+/**
+ * Opens (or creates) the cache directory for the jar under 'root'. A manifest that doesn't
+ * match the jar or this version of the mapper is ignored and the cache starts over.
+ */
+AssetCache* open_asset_cache(const char* root, AssetFS* assets) {
+    AssetCache* cache = malloc(sizeof(AssetCache));
+    snprintf(cache->jar_hash, sizeof(cache->jar_hash), "%016llx", (unsigned long long)assets->hash);
+    cache->jar_entries = assets->count;
+    cache->extracted = 0;
+    cache->biomes = 0;
+    cache->render_pack = 0;
+
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s/%s-v%d", root, cache->jar_hash, MAPPER_VERSION);
+    cache->dir = strdup(dir);
+
+    char path[1024 + 32];
+    snprintf(path, sizeof(path), "%s/manifest.txt", dir);
+    FILE* fp = fopen(path, "r");
+    if (fp != NULL) {
+        int version = -1;
+        int entries = -1;
+        char hash[64] = "";
+        int extracted = 0;
+        int biomes = 0;
+        int render_pack = 0;
+
+        char key[64];
+        char value[64];
+        while (fscanf(fp, "%63s %63s", key, value) == 2) {
+            if (strcmp(key, "mapper_version") == 0) version = atoi(value);
+            else if (strcmp(key, "jar_hash") == 0) snprintf(hash, sizeof(hash), "%s", value);
+            else if (strcmp(key, "jar_entries") == 0) entries = atoi(value);
+            else if (strcmp(key, "extracted") == 0) extracted = atoi(value);
+            else if (strcmp(key, "biomes") == 0) biomes = atoi(value);
+            else if (strcmp(key, "render_pack") == 0) render_pack = atoi(value);
+        }
+        fclose(fp);
+
+        if (version == MAPPER_VERSION && entries == cache->jar_entries && strcmp(hash, cache->jar_hash) == 0) {
+            cache->extracted = extracted;
+            cache->biomes = biomes;
+            cache->render_pack = render_pack;
+            return cache;
+        }
+        printf("%sAsset cache '%s' doesn't match the jar, rebuilding it%s\n", YELLOW, dir, RESET);
+    }
+
+    snprintf(path, sizeof(path), "%s/", dir);
+    make_dirs(path);
+    save_asset_cache(cache);
+    return cache;
+}
+
+/**
+ * Extracts the jar's models and textures into the cache, unless a previous run already has.
+ */
+void extract_jar_to_cache(AssetCache* cache, const char* jar_path) {
+    char out_dir[1024];
+    snprintf(out_dir, sizeof(out_dir), "%s/jar", cache->dir);
+    if (cache->extracted) {
+        printf("Using extracted assets in %s\n", out_dir);
+        return;
+    }
+
+    if (extract_jar(jar_path, out_dir) == 0) {
+        cache->extracted = 1;
+        save_asset_cache(cache);
+    }
+}
+
+// Converts the x y of a pixel to an index in the array (assumes 4 channel pixels)
+int pixel_index(int x, int y, int image_width) {
+    return (y * image_width + x) * 4;
+}
+
+// swaps two values
+void swap(int* a, int* b) {
+    int a_i = *a;
+    int b_i = *b;
+    *a = b_i;
+    *b = a_i;
+}
+
+// get's the value on the oppposite side of the flip value
+void flip(int* a, int flip_value) {
+    int dist = flip_value - *a;
+    *a = flip_value + dist;
+}
+
+
+/**
+ * The biome color a tinted pixel of a sprite takes, kept per pixel alongside the sprite so it
+ * can be drawn once and colored for each biome when it's put on the map (see 'blit_block').
+ */
+typedef enum {
+    TINT_NONE,
+    TINT_GRASS,
+    TINT_FOLIAGE,
+    TINT_WATER,
+    TINT_DRY_FOLIAGE, // white unless the biome has no downfall
+    TINT_CLASS_COUNT
+} TintClass;
+
+typedef struct {
+    char* name;
+    
+    double temperature;
+    double downfall;
+
+    // color overrides, -1 when the biome uses the colormaps
+    int grass_color;
     int foliage_color;
+    int dry_foliage_color;
     int water_color;
 
+    int grass_color_modifier; // GRASS_MODIFIER_*
+
+    Pixel tints[TINT_CLASS_COUNT]; // by TintClass, worked out once in 'init_biome_tints'
 } Biome;
 
-Map* load_biomes() {
-    Map* biome_name_to_biome_data = new_map();
+#define GRASS_MODIFIER_NONE 0
+#define GRASS_MODIFIER_DARK_FOREST 1
+#define GRASS_MODIFIER_SWAMP 2
+
+Biome* BIOMES = NULL; // biome id (see 'biome_id') -> biome, for every biome in the jar
+int BIOMES_LEN = 0;
+int BIOMES_CAPACITY = 0;
+
+// biomes the jar doesn't have (from mods or newer versions), the game's defaults
+Biome DEFAULT_BIOME = {
+    .name = "default", .temperature = 0.8, .downfall = 0.4,
+    .grass_color = -1, .foliage_color = -1, .dry_foliage_color = -1, .water_color = 0x3F76E4,
+};
+
+// a slot of 'BIOMES' that only holds DEFAULT_BIOME, for a name interned before the jar's biomes were added
+static int is_biome_gap(Biome* biome) {
+    return biome->name == DEFAULT_BIOME.name;
+}
+
+// takes ownership of the biome's name
+void add_biome(Biome* biome) {
+    uint16_t id = biome_id(biome->name);
+    if (id == UINT16_MAX) {
+        free(biome->name);
+        return;
+    }
+    if (id >= BIOMES_CAPACITY) {
+        int capacity = MAX(BIOMES_CAPACITY * 2, id + 64);
+        Biome* biomes = realloc(BIOMES, capacity * sizeof(Biome));
+        if (biomes == NULL) {
+            fprintf(stderr, "Failed allocating %zu bytes for biomes. Ran out of memory probably\n", capacity * sizeof(Biome));
+            exit(-1);
+        }
+        BIOMES = biomes;
+        BIOMES_CAPACITY = capacity;
+    }
+    for (int i = BIOMES_LEN; i < id; i++) {
+        BIOMES[i] = DEFAULT_BIOME; // see 'is_biome_gap'
+    }
+    if (id < BIOMES_LEN && !is_biome_gap(&BIOMES[id])) {
+        free(BIOMES[id].name); // added again, the latest one wins
+    }
+    BIOMES[id] = *biome;
+    if (id >= BIOMES_LEN) {
+        BIOMES_LEN = id + 1;
+    }
+}
+
+Biome* get_biome(uint16_t id) {
+    return id < BIOMES_LEN? &BIOMES[id] : &DEFAULT_BIOME;
+}
+
+/**
+ * Adds the biomes saved by 'save_biome_cache'. Returns 0 if there weren't any.
+ */
+int load_biome_cache(AssetCache* cache) {
+    if (cache == NULL || !cache->biomes) {
+        return 0;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/biomes.txt", cache->dir);
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        return 0;
+    }
+
+    // biome ids are 16 bit with UINT16_MAX meaning unknown, so more than that can't be right
+    int count = 0;
+    if (fscanf(fp, "%d", &count) != 1 || count <= 0 || count >= UINT16_MAX) {
+        printf("%sBiome cache '%s' is damaged, re-reading biomes from the jar%s\n", YELLOW, path, RESET);
+        fclose(fp);
+        return 0;
+    }
+
+    Biome* biomes = calloc(count, sizeof(Biome));
+    char name[256];
+    for (int i = 0; i < count; i++) {
+        Biome* biome = &biomes[i];
+        if (fscanf(fp, "%255s %lf %lf %d %d %d %d %d", name, &biome->temperature, &biome->downfall,
+                &biome->grass_color, &biome->foliage_color, &biome->dry_foliage_color, &biome->water_color,
+                &biome->grass_color_modifier) != 8) {
+            printf("%sBiome cache '%s' is damaged, re-reading biomes from the jar%s\n", YELLOW, path, RESET);
+            for (int j = 0; j < i; j++) {
+                free(biomes[j].name);
+            }
+            free(biomes);
+            fclose(fp);
+            return 0;
+        }
+        biome->name = strdup(name);
+    }
+    fclose(fp);
+
+    for (int i = 0; i < count; i++) {
+        add_biome(&biomes[i]);
+    }
+    free(biomes);
+    return 1;
+}
+
+void save_biome_cache(AssetCache* cache) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/biomes.txt", cache->dir);
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        perror("fopen");
+        return;
+    }
+
+    // gaps aren't biomes, saving them would bring 'default' back as one on the next run
+    int count = 0;
+    for (int i = 0; i < BIOMES_LEN; i++) {
+        count += !is_biome_gap(&BIOMES[i]);
+    }
+
+    fprintf(fp, "%d\n", count);
+    for (int i = 0; i < BIOMES_LEN; i++) {
+        Biome* biome = &BIOMES[i];
+        if (is_biome_gap(biome)) continue;
+        fprintf(fp, "%s %.17g %.17g %d %d %d %d %d\n", biome->name, biome->temperature, biome->downfall,
+            biome->grass_color, biome->foliage_color, biome->dry_foliage_color, biome->water_color,
+            biome->grass_color_modifier);
+    }
+    fclose(fp);
+
+    cache->biomes = 1;
+    save_asset_cache(cache);
+}
+
+/**
+ * Fills 'BIOMES' with the temperature, downfall and color overrides of every biome in the jar.
+ * Parsed from the jar the first time and then read from the asset cache.
+ */
+void load_biomes(AssetCache* cache) {
+    if (load_biome_cache(cache)) {
+        return;
+    }
 
     int count;
-    char** biome_files = collect_files(BIOME_PATH, &count);
+    char** biome_files = list_assets(BIOME_PATH, ".json", &count);
     for (int i = 0; i < count; i++) {
-        char* content = read_file(biome_files[i]);
+        char* content = read_asset(biome_files[i], NULL);
         cJSON *json = cJSON_Parse(content);
 
         cJSON *downfall = cJSON_GetObjectItem(json, "downfall");
@@ -1300,64 +2133,59 @@ Map* load_biomes() {
         cJSON *effects = cJSON_GetObjectItem(json, "effects");
         cJSON *grass_color = cJSON_GetObjectItem(effects, "grass_color");
         cJSON *foliage_color = cJSON_GetObjectItem(effects, "foliage_color");
+        cJSON *dry_foliage_color = cJSON_GetObjectItem(effects, "dry_foliage_color");
         cJSON *water_color = cJSON_GetObjectItem(effects, "water_color");
+        cJSON *grass_color_modifier = cJSON_GetObjectItem(effects, "grass_color_modifier");
+
+
+        Biome biome = {0};
+        biome.downfall = downfall? downfall->valuedouble : -1;
+        biome.temperature = temperature? temperature->valuedouble : -1;
+        biome.grass_color = grass_color? grass_color->valueint : -1;
+        biome.foliage_color = foliage_color? foliage_color->valueint : -1;
+        biome.dry_foliage_color = dry_foliage_color? dry_foliage_color->valueint : -1;
+        biome.water_color = water_color? water_color->valueint : -1;
+        biome.grass_color_modifier = GRASS_MODIFIER_NONE;
+        if (cJSON_IsString(grass_color_modifier)) {
+            if (strcmp(grass_color_modifier->valuestring, "dark_forest") == 0) biome.grass_color_modifier = GRASS_MODIFIER_DARK_FOREST;
+            else if (strcmp(grass_color_modifier->valuestring, "swamp") == 0) biome.grass_color_modifier = GRASS_MODIFIER_SWAMP;
+        }
 
+        // 'data/minecraft/worldgen/biome/plains.json' -> 'minecraft:plains'
+        char name[256];
+        const char* start = biome_files[i] + strlen(BIOME_PATH);
+        snprintf(name, sizeof(name), "minecraft:%.*s", (int)(strlen(start) - strlen(".json")), start);
+        biome.name = strdup(name);
 
-        Biome* biome = malloc(sizeof(Biome));
-        biome->downfall = downfall? downfall->valuedouble : -1;
-        biome->temperature = downfall? temperature->valuedouble : -1;
-        biome->grass_color = grass_color? grass_color->valueint : -1;
-        biome->foliage_color = foliage_color? foliage_color->valueint : -1;
-        biome->water_color = water_color? water_color->valueint : -1;
-
-        int n = 0;
-        char** splits = split(biome_files[i], "/", &n);
-        char* file_name = strdup(splits[n-1]);
-        free_array(splits, n);
-        splits = split(file_name, ".", &n);
-        file_name = cat("minecraft:", splits[0]);
-        free_array(splits, n);
-        biome->name = file_name;
-
-        m_put(biome_name_to_biome_data, file_name, biome, sizeof(Biome));
-
-
+        add_biome(&biome);
 
-        free(biome_files[i]);
         free(content);
-        cJSON_free(json);
-
+        cJSON_Delete(json);
     }
     free(biome_files);
-    
-
-    return biome_name_to_biome_data;
 
+    if (cache != NULL) {
+        save_biome_cache(cache);
+    }
 }
 
-typedef struct {
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
-    uint8_t a;
-} Pixel;
+// model coordinates run 0-16 (both ends included), the tables below cover all of them
+#define MODEL_COORDS 17
 
-/**
- * Convert model coordinates to texture coordinates
- * 
- * for top faces you'll want to input x and z
- * 
- * For side faces you'll do x and y or z and y
- */
-void model_coor_to_texture_x_y(int c_1, int c_2, int* t_x, int* t_y) {
-    *t_x = c_1;
-    *t_y = c_2;
+int8_t MODEL_TO_IMAGE_X[MODEL_COORDS][MODEL_COORDS][MODEL_COORDS]; // [x][y][z]
+int8_t MODEL_TO_IMAGE_Y[MODEL_COORDS][MODEL_COORDS][MODEL_COORDS];
+int8_t MODEL_TO_TEXTURE[MODEL_COORDS]; // flipped, the 16th coordinate shares the last texel
 
-    flip(t_x, 7);
-    flip(t_y, 7);
+// 'numerator / denominator' rounded half away from zero, like 'round'
+static int round_div(int numerator, int denominator) {
+    return numerator >= 0? (numerator + denominator / 2) / denominator : -((-numerator + denominator / 2) / denominator);
 }
 
-void model_x_y_z_to_image_x_y(int x, int y, int z, int* image_x, int* image_y) {
+/**
+ * Fills the model to sprite projection tables. The projection is the same for every angle (the
+ * model is turned to the side first, see 'apply_side_rotation') so one set covers them all.
+ */
+void init_projection_tables() {
     /*
 
     slope x = 1/2
@@ -1385,123 +2213,456 @@ void model_x_y_z_to_image_x_y(int x, int y, int z, int* image_x, int* image_y) {
         image_x = 8
         image_y = 15
     */
-    
-    *image_x = round(0.5*x + 0.5*z);
-    *image_y = round(-0.25*x + 11 + 0.25*z - 0.5*y);
+    for (int x = 0; x < MODEL_COORDS; x++) {
+        for (int y = 0; y < MODEL_COORDS; y++) {
+            for (int z = 0; z < MODEL_COORDS; z++) {
+                MODEL_TO_IMAGE_X[x][y][z] = round_div(x + z, 2);
+                MODEL_TO_IMAGE_Y[x][y][z] = round_div(-x + 44 + z - 2*y, 4);
+            }
+        }
+    }
+
+    for (int c = 0; c < MODEL_COORDS; c++) {
+        MODEL_TO_TEXTURE[c] = 15 - (c < 16? c : 15);
+    }
+}
+
+/**
+ * Convert model coordinates to texture coordinates
+ * 
+ * for top faces you'll want to input x and z
+ * 
+ * For side faces you'll do x and y or z and y
+ */
+static inline void model_coor_to_texture_x_y(int c_1, int c_2, int* t_x, int* t_y) {
+    *t_x = MODEL_TO_TEXTURE[c_1];
+    *t_y = MODEL_TO_TEXTURE[c_2];
 }
 
+// element corners outside the block are cut off at its edges so they stay in the tables
+static inline int model_coord(float c) {
+    return c < 0? 0 : c > MODEL_COORDS - 1? MODEL_COORDS - 1 : (int)c;
+}
 
-void apply_side_rotation(int side, int* x_start, int* x_end, int* z_start, int* z_end) {
+static inline void model_x_y_z_to_image_x_y(int x, int y, int z, int* image_x, int* image_y) {
+    *image_x = MODEL_TO_IMAGE_X[x][y][z];
+    *image_y = MODEL_TO_IMAGE_Y[x][y][z];
+}
 
-    if (side == 0) {
-        // no change
-    }
-    else if (side == 1) {
-        // 8, 8, 0 -> 16, 8, 8
-        // 16, 16, 16 -> 0, 16, 16
-        // swap x and z for both
-        // flip x for both
-        
-        swap(x_start, z_start);
-        swap(x_end, z_end);
 
-        flip(x_start, 8);
-        flip(x_end, 8);
-    }
-    else if (side == 2) {
-        // 8, 8, 0 -> 8, 8, 16
-        // 16, 16, 16 -> 0, 16, 0
-        // flip z for both
-        // flip x for both 
-        
-        flip(z_start, 8);
-        flip(z_end, 8);
 
-        flip(x_start, 8);
-        flip(x_end, 8);
-    }
-    else if (side == 3) {
-        // 8, 8, 0 -> 0, 8, 8
-        // 16, 16, 16 -> 16, 16, 0
-        // swap x and z for both
-        // flip z for both
+// ANGLES
+
+typedef struct {
+    int x;
+    int z;
+} Coord;
 
-        swap(x_start, z_start);
-        swap(x_end, z_end);
+/**
+ * Everything that depends on the viewing angle, generated once per angle by 'DEFINE_ANGLE' so the
+ * per block code has constant coefficients and no angle checks. Look the set up with 'ANGLE_SPECS[angle]'.
+ *
+ * A block at x y z goes to (X_X*x + Z_X*z, X_Y*x + Z_Y*z - 8*y) on the canvas. Blocks lower on the
+ * canvas are nearer the viewer, so painter's order (far to near) is ascending X_Y*x + Z_Y*z.
+ *
+ * Sprites are drawn with the model turned to the side facing the viewer: x and z are swapped when
+ * SWAP_XZ, then mirrored about the block's center when FLIP_X / FLIP_Z.
+ */
+typedef struct {
+    void (*block_to_render)(int x, int y, int z, int* image_x, int* image_y);
+    int (*compare_coords)(const void* a, const void* b);
+    int (*compare_mca_paths)(const void* a, const void* b);
+    void (*side_rotation)(int* x_start, int* x_end, int* z_start, int* z_end);
+} AngleSpec;
+
+#define DEFINE_ANGLE(NAME, X_X, Z_X, X_Y, Z_Y, SWAP_XZ, FLIP_X, FLIP_Z) \
+static void block_to_render_##NAME(int x, int y, int z, int* image_x, int* image_y) { \
+    *image_x = X_X*x + Z_X*z; \
+    *image_y = X_Y*x + Z_Y*z - 8*y; \
+} \
+static int compare_depths_##NAME(long long first_x, long long first_z, long long second_x, long long second_z) { \
+    long long first = X_Y*first_x + Z_Y*first_z; \
+    long long second = X_Y*second_x + Z_Y*second_z; \
+    return (first > second) - (first < second); \
+} \
+static int compare_coords_##NAME(const void* a, const void* b) { \
+    const Coord* first = (const Coord*)a; \
+    const Coord* second = (const Coord*)b; \
+    return compare_depths_##NAME(first->x, first->z, second->x, second->z); \
+} \
+static int compare_mca_paths_##NAME(const void* a, const void* b) { \
+    long long first_x = 0, first_z = 0, second_x = 0, second_z = 0; \
+    extract_mca_region_coordinates(*(const char**)a, &first_x, &first_z); \
+    extract_mca_region_coordinates(*(const char**)b, &second_x, &second_z); \
+    return compare_depths_##NAME(first_x, first_z, second_x, second_z); \
+} \
+static void side_rotation_##NAME(int* x_start, int* x_end, int* z_start, int* z_end) { \
+    if (SWAP_XZ) { swap(x_start, z_start); swap(x_end, z_end); } \
+    if (FLIP_X) { flip(x_start, 8); flip(x_end, 8); } \
+    if (FLIP_Z) { flip(z_start, 8); flip(z_end, 8); } \
+}
 
-        flip(z_start, 8);
-        flip(z_end, 8);
+//           X_X Z_X X_Y Z_Y  SWAP FLIP_X FLIP_Z
+DEFINE_ANGLE(SW,  8, -8, -4, -4,  0,   0,     0)
+DEFINE_ANGLE(NW, -8, -8, -4,  4,  1,   1,     0) // 8, 8, 0 -> 16, 8, 8
+DEFINE_ANGLE(NE, -8,  8,  4,  4,  0,   1,     1) // 8, 8, 0 -> 8, 8, 16
+DEFINE_ANGLE(SE,  8,  8,  4, -4,  1,   0,     1) // 8, 8, 0 -> 0, 8, 8
+
+#define ANGLE_SPEC(NAME) {block_to_render_##NAME, compare_coords_##NAME, compare_mca_paths_##NAME, side_rotation_##NAME}
+
+AngleSpec ANGLE_SPECS[ANGLE_COUNT] = {
+    [ANGLE_SW] = ANGLE_SPEC(SW),
+    [ANGLE_NW] = ANGLE_SPEC(NW),
+    [ANGLE_NE] = ANGLE_SPEC(NE),
+    [ANGLE_SE] = ANGLE_SPEC(SE),
+};
+
+// 1 and the angle in 'angle' if 'name' is one of 'ANGLE_NAMES', otherwise 0
+int parse_angle(const char* name, Angle* angle) {
+    for (int i = 0; i < ANGLE_COUNT; i++) {
+        if (strcmp(name, ANGLE_NAMES[i]) == 0) {
+            *angle = (Angle)i;
+            return 1;
+        }
     }
+    return 0;
+}
+
+// turns a face's model coordinates to the sprite 'side' (an 'Angle'), see 'DEFINE_ANGLE'
+static inline void apply_side_rotation(int side, int* x_start, int* x_end, int* z_start, int* z_end) {
+    ANGLE_SPECS[side].side_rotation(x_start, x_end, z_start, z_end);
 }
 
 int is_grayscale(uint8_t r, uint8_t g, uint8_t b) {
     return r == g && g == b;
 }
 
-void set_top_square(uint8_t* image, int side, uint8_t* top_texture, cJSON* from, cJSON* to, Pixel* tint) {
 
-    // DETERMINE indices
-    int model_x_start = cJSON_GetArrayItem(from, 0)->valueint;
-    int model_x_end = cJSON_GetArrayItem(to, 0)->valueint;
-    int model_y = cJSON_GetArrayItem(to, 1)->valueint;
-    int model_z_start = cJSON_GetArrayItem(from, 2)->valueint;
-    int model_z_end = cJSON_GetArrayItem(to, 2)->valueint;
+// PIXEL KERNELS
 
-    apply_side_rotation(side, &model_x_start, &model_x_end, &model_z_start, &model_z_end);
+/**
+ * Tinting and layer compositing over runs of RGBA pixels, the per pixel passes every sprite goes
+ * through when it's drawn and when it's put on the map. The vector versions handle 4 (SSE2, NEON) or 8 (AVX2) pixels a step with the
+ * scalar versions finishing any tail, and give exactly the same bytes as the scalar ones.
+ *
+ * The instruction set is picked at compile time: SSE2 is on for every x86-64 build, AVX2 needs
+ * '-mavx2' (or '-march=native'), NEON is on for arm64. Build with -DNO_SIMD to use the scalar kernels.
+ */
+#if !defined(NO_SIMD) && defined(__AVX2__)
+#define SIMD_KERNELS "AVX2"
+#define SIMD_X86
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+#define SIMD_KERNELS "SSE2"
+#define SIMD_X86
+#elif !defined(NO_SIMD) && defined(__ARM_NEON)
+#define SIMD_KERNELS "NEON"
+#define SIMD_NEON
+#else
+#define SIMD_KERNELS "scalar"
+#endif
 
+// 'value / 255' rounded down, exact for 0 <= value <= 255*255 and without the divide
+static inline int div_255(int value) {
+    return (value + 1 + (value >> 8)) >> 8;
+}
 
-    // FOR EACH square walk x y of square on texture converting to image pixels
-    int x_step = (model_x_start <= model_x_end)? 1 : -1;
-    int z_step = (model_z_start <= model_z_end)? 1 : -1;
+// multiplies each pixel by the color for its tint class in 'tints' (a biome's), TINT_NONE pixels are left as they are
+void tint_pixels_scalar(uint8_t* pixels, const uint8_t* classes, const Pixel* tints, int count) {
+    for (int p = 0; p < count; p++) {
+        if (classes[p] != TINT_NONE) {
+            uint8_t* pixel = pixels + p*4;
+            const Pixel* tint = &tints[classes[p]];
+            pixel[0] = div_255(pixel[0] * tint->r);
+            pixel[1] = div_255(pixel[1] * tint->g);
+            pixel[2] = div_255(pixel[2] * tint->b);
+        }
+    }
+}
 
-    printf("\n");
-    model_x_end = model_x_end == 0? -1 : model_x_end;
-    model_z_end = model_z_end == 0? -1 : model_z_end;
-    for (int x = model_x_start; x != model_x_end; x+=x_step) {
-        for (int z = model_z_start; z != model_z_end; z+=z_step) {
-            if (x == model_x_end) continue;
-            if (z == model_z_end) continue;
-            
-            // convert to image coordinates
-            int image_x, image_y;
-            model_x_y_z_to_image_x_y(x, model_y, z, &image_x, &image_y);
+// copies the pixels of 'layer' that are drawn (non zero red, like 'set_top_square' checks) over 'result'
+void composite_pixels_scalar(uint8_t* result, const uint8_t* layer, int count) {
+    for (int p = 0; p < count; p++) {
+        uint32_t drawn, under;
+        memcpy(&drawn, layer + p*4, 4);
+        memcpy(&under, result + p*4, 4);
+        uint32_t mask = -(uint32_t)(layer[p*4] != 0);
+        uint32_t pixel = (drawn & mask) | (under & ~mask);
+        memcpy(result + p*4, &pixel, 4);
+    }
+}
 
-            // skip out of bounds stuff
-            if (image_x == 16 || image_y == 16 || image_x == -1 || image_y == -1) continue;
+/**
+ * Keeps the tint classes of a sprite in step with 'composite_pixels': where 'layer' is drawn the
+ * class becomes 'tint_class' if the pixel is gray (r == g == b, the parts of grass and leaf
+ * textures that get colored) and TINT_NONE otherwise.
+ */
+void composite_tint_classes(uint8_t* classes, const uint8_t* layer, TintClass tint_class, int count) {
+    for (int p = 0; p < count; p++) {
+        const uint8_t* pixel = layer + p*4;
+        if (pixel[0] != 0) {
+            classes[p] = is_grayscale(pixel[0], pixel[1], pixel[2])? tint_class : TINT_NONE;
+        }
+    }
+}
+
+/**
+ * Bit c is set when some pixel might have tint class c: every class whose bits are all in the OR
+ * of the classes. That's exact for a sprite with one class (or none), which is nearly all of them.
+ */
+static inline int used_tint_classes(const uint8_t* classes, int count) {
+    uint64_t any = 0;
+    int p = 0;
+    for (; p + 8 <= count; p += 8) {
+        uint64_t eight;
+        memcpy(&eight, classes + p, 8);
+        any |= eight;
+    }
+    for (; p < count; p++) {
+        any |= classes[p];
+    }
+    any |= any >> 32;
+    any |= any >> 16;
+    any |= any >> 8;
 
+    int used = 0;
+    for (int c = TINT_NONE + 1; c < TINT_CLASS_COUNT; c++) {
+        if ((c & any) == (uint64_t)c) used |= 1 << c;
+    }
+    return used;
+}
 
-            // if pixel set by other coordinates skip
-            int i = pixel_index(image_x, image_y, 16);
-            if (image[i] == 0) {
-                printf("x: %d, y: %d\n", image_x, image_y);
+// a tint as an r g b 255 word, alpha times 255 / 255 is alpha again
+static inline uint32_t tint_word(Pixel tint) {
+    uint32_t word;
+    tint.a = 255;
+    memcpy(&word, &tint, 4);
+    return word;
+}
 
-                // otherwise set it
-                int tex_x, tex_y;
-                model_coor_to_texture_x_y(x, z, &tex_x, &tex_y);
-                int t = pixel_index(tex_x, tex_y, 16);
+#if defined(SIMD_X86)
+
+#if defined(__AVX2__)
+typedef __m256i PixelVector;
+#define PIXEL_VECTOR_PIXELS 8
+#define pv_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define pv_store(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define pv_set1_32(x) _mm256_set1_epi32(x)
+#define pv_set1_16(x) _mm256_set1_epi16(x)
+#define pv_zero() _mm256_setzero_si256()
+#define pv_and(a, b) _mm256_and_si256(a, b)
+#define pv_andnot(a, b) _mm256_andnot_si256(a, b)
+#define pv_or(a, b) _mm256_or_si256(a, b)
+#define pv_eq8(a, b) _mm256_cmpeq_epi8(a, b)
+#define pv_slli32(a, n) _mm256_slli_epi32(a, n)
+#define pv_srai32(a, n) _mm256_srai_epi32(a, n)
+#define pv_srli16(a, n) _mm256_srli_epi16(a, n)
+#define pv_add16(a, b) _mm256_add_epi16(a, b)
+#define pv_mul16(a, b) _mm256_mullo_epi16(a, b)
+#define pv_unpacklo8(a, b) _mm256_unpacklo_epi8(a, b)
+#define pv_unpackhi8(a, b) _mm256_unpackhi_epi8(a, b)
+#define pv_packus16(a, b) _mm256_packus_epi16(a, b)
+
+// all ones in the pixels whose tint class is 'tint_class'
+static inline PixelVector pv_class_mask(const uint8_t* classes, int tint_class) {
+    __m128i same = _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*)classes), _mm_set1_epi8((char)tint_class));
+    return _mm256_cvtepi8_epi32(same);
+}
+#else
+typedef __m128i PixelVector;
+#define PIXEL_VECTOR_PIXELS 4
+#define pv_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define pv_store(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define pv_set1_32(x) _mm_set1_epi32(x)
+#define pv_set1_16(x) _mm_set1_epi16(x)
+#define pv_zero() _mm_setzero_si128()
+#define pv_and(a, b) _mm_and_si128(a, b)
+#define pv_andnot(a, b) _mm_andnot_si128(a, b)
+#define pv_or(a, b) _mm_or_si128(a, b)
+#define pv_eq8(a, b) _mm_cmpeq_epi8(a, b)
+#define pv_slli32(a, n) _mm_slli_epi32(a, n)
+#define pv_srai32(a, n) _mm_srai_epi32(a, n)
+#define pv_srli16(a, n) _mm_srli_epi16(a, n)
+#define pv_add16(a, b) _mm_add_epi16(a, b)
+#define pv_mul16(a, b) _mm_mullo_epi16(a, b)
+#define pv_unpacklo8(a, b) _mm_unpacklo_epi8(a, b)
+#define pv_unpackhi8(a, b) _mm_unpackhi_epi8(a, b)
+#define pv_packus16(a, b) _mm_packus_epi16(a, b)
+
+// all ones in the pixels whose tint class is 'tint_class'
+static inline PixelVector pv_class_mask(const uint8_t* classes, int tint_class) {
+    uint32_t four;
+    memcpy(&four, classes, 4);
+    __m128i same = _mm_cmpeq_epi8(_mm_cvtsi32_si128((int)four), _mm_set1_epi8((char)tint_class));
+    same = _mm_unpacklo_epi8(same, same);
+    return _mm_unpacklo_epi16(same, same);
+}
+#endif
 
-                image[i] = top_texture[t];
-                image[i+1] = top_texture[t+1];
-                image[i+2] = top_texture[t+2];
-                image[i+3] = top_texture[t+3];
-                // printf("%d\n", top_texture[t+3]);
+// all ones in the pixels whose red byte in 'bytes' is all ones
+static inline PixelVector pv_red_mask(PixelVector bytes) {
+    return pv_srai32(pv_slli32(bytes, 24), 24);
+}
 
-                // apply tint if applicable
-                if (is_grayscale(image[i], image[i+1], image[i+2])) {
-                    image[i] = (image[i] * tint->r) / 255;
-                    image[i+1] = (image[i+1] * tint->g) / 255;
-                    image[i+2] = (image[i+2] * tint->b) / 255;
-                }
-                // stbi_write_jpg("test.jpg", 16, 16, 4, image, 96);
-            }
+static inline PixelVector pv_select(PixelVector mask, PixelVector yes, PixelVector no) {
+    return pv_or(pv_and(mask, yes), pv_andnot(mask, no));
+}
+
+// 'a * b / 255' per 16 bit lane, see 'div_255'
+static inline PixelVector pv_mul_div_255(PixelVector a, PixelVector b) {
+    PixelVector product = pv_mul16(a, b);
+    return pv_srli16(pv_add16(pv_add16(product, pv_set1_16(1)), pv_srli16(product, 8)), 8);
+}
 
+void tint_pixels(uint8_t* pixels, const uint8_t* classes, const Pixel* tints, int count) {
+    int vector_count = count - count % PIXEL_VECTOR_PIXELS;
+    int used = used_tint_classes(classes, vector_count);
+
+    // a pass for each class used
+    for (int c = TINT_NONE + 1; c < TINT_CLASS_COUNT; c++) {
+        if (!(used & (1 << c))) continue;
+
+        // the tint as 16 bit lanes
+        PixelVector tint_16 = pv_unpacklo8(pv_set1_32((int)tint_word(tints[c])), pv_zero());
+        for (int p = 0; p < vector_count; p += PIXEL_VECTOR_PIXELS) {
+            PixelVector v = pv_load(pixels + p*4);
+            PixelVector low = pv_mul_div_255(pv_unpacklo8(v, pv_zero()), tint_16);
+            PixelVector high = pv_mul_div_255(pv_unpackhi8(v, pv_zero()), tint_16);
+            pv_store(pixels + p*4, pv_select(pv_class_mask(classes + p, c), pv_packus16(low, high), v));
         }
     }
+    tint_pixels_scalar(pixels + vector_count*4, classes + vector_count, tints, count - vector_count);
 }
 
-void set_left_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* overlay_texture, cJSON* from, cJSON* to, Pixel* tint) {
+void composite_pixels(uint8_t* result, const uint8_t* layer, int count) {
+    int p = 0;
+    for (; p + PIXEL_VECTOR_PIXELS <= count; p += PIXEL_VECTOR_PIXELS) {
+        PixelVector v = pv_load(layer + p*4);
+        PixelVector empty = pv_red_mask(pv_eq8(v, pv_zero()));
+        pv_store(result + p*4, pv_select(empty, pv_load(result + p*4), v));
+    }
+    composite_pixels_scalar(result + p*4, layer + p*4, count - p);
+}
 
-    // DETERMINE indices
+#elif defined(SIMD_NEON)
+
+// all ones in the pixels whose red byte in 'bytes' is all ones
+static inline uint8x16_t neon_red_mask(uint8x16_t bytes) {
+    return vreinterpretq_u8_s32(vshrq_n_s32(vshlq_n_s32(vreinterpretq_s32_u8(bytes), 24), 24));
+}
+
+// 'a * b / 255' per byte, see 'div_255'
+static inline uint8x8_t neon_mul_div_255(uint8x8_t a, uint8x8_t b) {
+    uint16x8_t product = vmull_u8(a, b);
+    return vshrn_n_u16(vaddq_u16(vaddq_u16(product, vdupq_n_u16(1)), vshrq_n_u16(product, 8)), 8);
+}
+
+// all ones in the pixels whose tint class is 'tint_class'
+static inline uint8x16_t neon_class_mask(const uint8_t* classes, int tint_class) {
+    uint32_t four;
+    memcpy(&four, classes, 4);
+    uint8x8_t same = vceq_u8(vreinterpret_u8_u32(vdup_n_u32(four)), vdup_n_u8((uint8_t)tint_class));
+    int16x8_t same_16 = vmovl_s8(vreinterpret_s8_u8(same));
+    return vreinterpretq_u8_s32(vmovl_s16(vget_low_s16(same_16)));
+}
+
+void tint_pixels(uint8_t* pixels, const uint8_t* classes, const Pixel* tints, int count) {
+    int vector_count = count - count % 4;
+    int used = used_tint_classes(classes, vector_count);
+
+    // a pass for each class used
+    for (int c = TINT_NONE + 1; c < TINT_CLASS_COUNT; c++) {
+        if (!(used & (1 << c))) continue;
+
+        uint8x8_t tint_8 = vreinterpret_u8_u32(vdup_n_u32(tint_word(tints[c])));
+        for (int p = 0; p < vector_count; p += 4) {
+            uint8x16_t v = vld1q_u8(pixels + p*4);
+            uint8x16_t tinted = vcombine_u8(
+                neon_mul_div_255(vget_low_u8(v), tint_8),
+                neon_mul_div_255(vget_high_u8(v), tint_8)
+            );
+            vst1q_u8(pixels + p*4, vbslq_u8(neon_class_mask(classes + p, c), tinted, v));
+        }
+    }
+    tint_pixels_scalar(pixels + vector_count*4, classes + vector_count, tints, count - vector_count);
+}
+
+void composite_pixels(uint8_t* result, const uint8_t* layer, int count) {
+    int p = 0;
+    for (; p + 4 <= count; p += 4) {
+        uint8x16_t v = vld1q_u8(layer + p*4);
+        uint8x16_t empty = neon_red_mask(vceqq_u8(v, vdupq_n_u8(0)));
+        vst1q_u8(result + p*4, vbslq_u8(empty, vld1q_u8(result + p*4), v));
+    }
+    composite_pixels_scalar(result + p*4, layer + p*4, count - p);
+}
+
+#else
+
+void tint_pixels(uint8_t* pixels, const uint8_t* classes, const Pixel* tints, int count) {
+    tint_pixels_scalar(pixels, classes, tints, count);
+}
+
+void composite_pixels(uint8_t* result, const uint8_t* layer, int count) {
+    composite_pixels_scalar(result, layer, count);
+}
+
+#endif
+
+
+void set_top_square(uint8_t* image, int side, uint8_t* top_texture, const float* from, const float* to) {
+
+    // DETERMINE indices
+    int model_x_start = model_coord(from[0]);
+    int model_x_end = model_coord(to[0]);
+    int model_y = model_coord(to[1]);
+    int model_z_start = model_coord(from[2]);
+    int model_z_end = model_coord(to[2]);
+
+    apply_side_rotation(side, &model_x_start, &model_x_end, &model_z_start, &model_z_end);
+
+
+    // FOR EACH square walk x y of square on texture converting to image pixels
+    int x_step = (model_x_start <= model_x_end)? 1 : -1;
+    int z_step = (model_z_start <= model_z_end)? 1 : -1;
+
+    model_x_end = model_x_end == 0? -1 : model_x_end;
+    model_z_end = model_z_end == 0? -1 : model_z_end;
+    for (int x = model_x_start; x != model_x_end; x+=x_step) {
+        for (int z = model_z_start; z != model_z_end; z+=z_step) {
+            if (x == model_x_end) continue;
+            if (z == model_z_end) continue;
+            
+            // convert to image coordinates
+            int image_x, image_y;
+            model_x_y_z_to_image_x_y(x, model_y, z, &image_x, &image_y);
+
+            // skip out of bounds stuff
+            if (image_x == 16 || image_y == 16 || image_x == -1 || image_y == -1) continue;
+
+
+            // if pixel set by other coordinates skip
+            int i = pixel_index(image_x, image_y, 16);
+            if (image[i] == 0) {
+                // otherwise set it
+                int tex_x, tex_y;
+                model_coor_to_texture_x_y(x, z, &tex_x, &tex_y);
+                int t = pixel_index(tex_x, tex_y, 16);
+
+                image[i] = top_texture[t];
+                image[i+1] = top_texture[t+1];
+                image[i+2] = top_texture[t+2];
+                image[i+3] = top_texture[t+3];
+                // printf("%d\n", top_texture[t+3]);
+
+            }
+
+        }
+    }
+}
+
+void set_left_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* overlay_texture, const float* from, const float* to) {
+
+    // DETERMINE indices
     int model_x_start;
     int model_x_end;
     int model_y_start;
@@ -1509,35 +2670,35 @@ void set_left_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* o
     int model_z_start;
     int model_z_end;
     if (side == 0) {
-        model_x_start = cJSON_GetArrayItem(from, 0)->valueint;
+        model_x_start = model_coord(from[0]);
         model_x_end = model_x_start;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(from, 2)->valueint;
-        model_z_end = cJSON_GetArrayItem(to, 2)->valueint;
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(from[2]);
+        model_z_end = model_coord(to[2]);
     }
     else if (side == 1) {
-        model_x_start = cJSON_GetArrayItem(from, 0)->valueint;
-        model_x_end = cJSON_GetArrayItem(to, 0)->valueint;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(to, 2)->valueint;
+        model_x_start = model_coord(from[0]);
+        model_x_end = model_coord(to[0]);
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(to[2]);
         model_z_end = model_z_start;
     }
     else if (side == 2) {
-        model_x_start = cJSON_GetArrayItem(to, 0)->valueint;
+        model_x_start = model_coord(to[0]);
         model_x_end = model_x_start;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(from, 2)->valueint;
-        model_z_end = cJSON_GetArrayItem(to, 2)->valueint;
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(from[2]);
+        model_z_end = model_coord(to[2]);
     }
     else if (side == 3) {
-        model_x_start = cJSON_GetArrayItem(from, 0)->valueint;
-        model_x_end = cJSON_GetArrayItem(to, 0)->valueint;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(from, 2)->valueint;
+        model_x_start = model_coord(from[0]);
+        model_x_end = model_coord(to[0]);
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(from[2]);
         model_z_end = model_z_start;
     }
     apply_side_rotation(side, &model_x_start, &model_x_end, &model_z_start, &model_z_end);
@@ -1552,7 +2713,6 @@ void set_left_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* o
     int model_h_end = (model_x_start == model_x_end)? model_z_end : model_x_end;
     int h_step = (model_x_start == model_x_end)? z_step : x_step;
 
-    printf("\n");
     model_y_end = model_y_end == 0? -1 : model_y_end;
     model_h_end = model_h_end == 0? -1 : model_h_end;
     for (int y = model_y_start; y != model_y_end; y+=y_step) {
@@ -1576,8 +2736,6 @@ void set_left_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* o
             // if pixel set by other coordinates skip
             int i = pixel_index(image_x, image_y, 16);
             if (image[i] == 0) {
-                printf("h:%d, m_y:%d;  x: %d, y: %d\n", h, y, image_x, image_y);
-
                 // otherwise set it
                 int tex_x, tex_y;
                 model_coor_to_texture_x_y(h, y, &tex_x, &tex_y);
@@ -1587,7 +2745,6 @@ void set_left_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* o
                 image[i+1] = side_texture[t+1];
                 image[i+2] = side_texture[t+2];
                 image[i+3] = side_texture[t+3];
-                // stbi_write_jpg("test.jpg", 16, 16, 4, image, 96);
 
                 if (overlay_texture != NULL) {
                     if (overlay_texture[t+3] > 0) {
@@ -1598,18 +2755,12 @@ void set_left_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* o
                     }
                 }
                 
-                // apply tint if applicable
-                if (is_grayscale(image[i], image[i+1], image[i+2])) {
-                    image[i] = (image[i] * tint->r) / 255;
-                    image[i+1] = (image[i+1] * tint->g) / 255;
-                    image[i+2] = (image[i+2] * tint->b) / 255;
-                }
             }
         }
     }
 }
 
-void set_right_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* overlay_texture, cJSON* from, cJSON* to, Pixel* tint) {
+void set_right_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t* overlay_texture, const float* from, const float* to) {
 
     // DETERMINE indices
     int model_x_start;
@@ -1619,36 +2770,36 @@ void set_right_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t*
     int model_z_start;
     int model_z_end;
     if (side == 0) {
-        model_x_start = cJSON_GetArrayItem(from, 0)->valueint;
-        model_x_end = cJSON_GetArrayItem(to, 0)->valueint;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(to, 2)->valueint;
+        model_x_start = model_coord(from[0]);
+        model_x_end = model_coord(to[0]);
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(to[2]);
         model_z_end = model_z_start;
     }
     else if (side == 1) {
-        model_x_start = cJSON_GetArrayItem(to, 0)->valueint;
+        model_x_start = model_coord(to[0]);
         model_x_end = model_x_start;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(from, 2)->valueint;
-        model_z_end = cJSON_GetArrayItem(to, 2)->valueint;
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(from[2]);
+        model_z_end = model_coord(to[2]);
     }
     else if (side == 2) {
-        model_x_start = cJSON_GetArrayItem(from, 0)->valueint;
-        model_x_end = cJSON_GetArrayItem(to, 0)->valueint;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(from, 2)->valueint;
+        model_x_start = model_coord(from[0]);
+        model_x_end = model_coord(to[0]);
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(from[2]);
         model_z_end = model_z_start;
     }
     else if (side == 3) {
-        model_x_start = cJSON_GetArrayItem(from, 0)->valueint;
+        model_x_start = model_coord(from[0]);
         model_x_end = model_x_start;
-        model_y_start = cJSON_GetArrayItem(from, 1)->valueint;
-        model_y_end = cJSON_GetArrayItem(to, 1)->valueint;
-        model_z_start = cJSON_GetArrayItem(from, 2)->valueint;
-        model_z_end = cJSON_GetArrayItem(to, 2)->valueint;
+        model_y_start = model_coord(from[1]);
+        model_y_end = model_coord(to[1]);
+        model_z_start = model_coord(from[2]);
+        model_z_end = model_coord(to[2]);
     }
 
     apply_side_rotation(side, &model_x_start, &model_x_end, &model_z_start, &model_z_end);
@@ -1659,443 +2810,1913 @@ void set_right_square(uint8_t* image, int side, uint8_t* side_texture, uint8_t*
     int y_step = (model_y_start <= model_y_end)? 1 : -1;
     int z_step = (model_z_start <= model_z_end)? 1 : -1;
 
-    int model_h_start = (model_x_start == model_x_end)? model_z_start : model_x_start;
-    int model_h_end = (model_x_start == model_x_end)? model_z_end : model_x_end;
-    int h_step = (model_x_start == model_x_end)? z_step : x_step;
+    int model_h_start = (model_x_start == model_x_end)? model_z_start : model_x_start;
+    int model_h_end = (model_x_start == model_x_end)? model_z_end : model_x_end;
+    int h_step = (model_x_start == model_x_end)? z_step : x_step;
+
+    model_y_end = model_y_end == 0? -1 : model_y_end;
+    model_h_end = model_h_end == 0? -1 : model_h_end;
+    for (int y = model_y_start; y != model_y_end; y+=y_step) {
+        for (int h = model_h_start; h != model_h_end; h+=h_step) {
+            if (h == model_h_end) continue;
+            if (y == model_y_end) continue;
+            
+            // convert to image coordinates
+            int image_x, image_y;
+            if (model_x_start == model_x_end) {
+                model_x_y_z_to_image_x_y(model_x_start, y, h, &image_x, &image_y);
+            }
+            else {
+                model_x_y_z_to_image_x_y(h, y, model_z_start, &image_x, &image_y);
+            }
+
+            // skip out of bounds stuff
+            if (image_x == 16 || image_y == 16 || image_x == -1 || image_y == -1) continue;
+
+
+            // if pixel set by other coordinates skip
+            int i = pixel_index(image_x, image_y, 16);
+            if (image[i] == 0) {
+                // otherwise set it
+                int tex_x, tex_y;
+                model_coor_to_texture_x_y(h, y, &tex_x, &tex_y);
+                int t = pixel_index(tex_x, tex_y, 16);
+
+                image[i] = side_texture[t];
+                image[i+1] = side_texture[t+1];
+                image[i+2] = side_texture[t+2];
+                image[i+3] = side_texture[t+3];
+
+                if (overlay_texture != NULL) {
+                    if (overlay_texture[t+3] > 0) {
+                        image[i] = overlay_texture[t];
+                        image[i+1] = overlay_texture[t+1];
+                        image[i+2] = overlay_texture[t+2];
+                        image[i+3] = overlay_texture[t+3];
+                    }
+                }
+
+            }
+        }
+    }
+}
+
+/**
+ * Draws the three layers over 'result' in order, each covering the last where it's drawn.
+ *
+ * Layers are combined before they're tinted (see 'blit_block'), so a gray pixel counts as drawn
+ * even in a biome whose tint takes its red to 0. Back when layers were tinted first such a pixel
+ * was skipped and the layer under it showed through.
+ */
+void combine_images(uint8_t* result, uint8_t* img_1, uint8_t* img_2, uint8_t* img_3, int size) {
+    composite_pixels(result, img_1, size * size);
+    composite_pixels(result, img_2, size * size);
+    composite_pixels(result, img_3, size * size);
+}
+
+
+
+#define TEXTURE_SIZE 16
+#define TEXTURE_BYTES (TEXTURE_SIZE * TEXTURE_SIZE * 4)
+
+/**
+ * Every texture used so far, decoded once into one contiguous block of 16x16 RGBA slots.
+ *
+ * The atlas has a slot for every png in the jar's textures folder from the start, so it never
+ * moves and pointers into it stay valid. Textures are decoded on first use.
+ */
+typedef struct {
+    uint8_t* pixels; // slot i is at 'pixels + i * TEXTURE_BYTES'
+    int len;
+    int capacity;
+    Map* name_to_slot; // 'block/stone' -> slot + 1, or MISSING_TEXTURE if it isn't in the jar
+    pthread_mutex_t lock;
+} TextureAtlas;
+
+#define MISSING_TEXTURE ((void*)(uintptr_t)-1)
+
+TextureAtlas* TEXTURES = NULL;
+
+void init_texture_atlas() {
+    int count;
+    char** pngs = list_assets(TEXTURE_PATH, ".png", &count);
+    free(pngs);
+
+    TEXTURES = malloc(sizeof(TextureAtlas));
+    TEXTURES->capacity = count;
+    TEXTURES->len = 0;
+    TEXTURES->pixels = calloc((size_t)count * TEXTURE_BYTES, 1);
+    TEXTURES->name_to_slot = new_map_reserved(count);
+    pthread_mutex_init(&TEXTURES->lock, NULL);
+}
+
+/**
+ * Copies a png into a 16x16 slot. Animated textures are a vertical strip of frames, only the
+ * first frame is kept. Textures with a different resolution are sampled down (or up) to 16x16.
+ */
+void copy_first_frame(uint8_t* slot, const uint8_t* png, int width, int height) {
+    int frame_size = width < height? width : height;
+    for (int y = 0; y < TEXTURE_SIZE; y++) {
+        for (int x = 0; x < TEXTURE_SIZE; x++) {
+            int png_x = x * frame_size / TEXTURE_SIZE;
+            int png_y = y * frame_size / TEXTURE_SIZE;
+            memcpy(slot + pixel_index(x, y, TEXTURE_SIZE), png + pixel_index(png_x, png_y, width), 4);
+        }
+    }
+}
+
+/**
+ * Returns the 16x16 pixels for a texture ('minecraft:block/stone' or 'block/stone'), or NULL
+ * if the jar doesn't have it. The pixels belong to the atlas, don't free them.
+ */
+uint8_t* load_texture(char* texture_minecraft_name) {
+    char* name = texture_minecraft_name;
+    if (strncmp(name, "minecraft:", strlen("minecraft:")) == 0) {
+        name += strlen("minecraft:");
+    }
+
+    pthread_mutex_lock(&TEXTURES->lock);
+    void* found = m_get(TEXTURES->name_to_slot, name);
+    pthread_mutex_unlock(&TEXTURES->lock);
+
+    if (found == NULL) {
+        // decoded without the lock so several threads can load textures at once
+        char* path = CAT(TEXTURE_PATH, name, ".png", NULL);
+        int width, height;
+        uint8_t* png = load_png_asset(path, &width, &height);
+        free(path);
+
+        pthread_mutex_lock(&TEXTURES->lock);
+        found = m_get(TEXTURES->name_to_slot, name); // another thread may have loaded it meanwhile
+        if (found == NULL) {
+            if (png == NULL || TEXTURES->len == TEXTURES->capacity) {
+                found = MISSING_TEXTURE;
+            }
+            else {
+                int slot = TEXTURES->len++;
+                copy_first_frame(TEXTURES->pixels + (size_t)slot * TEXTURE_BYTES, png, width, height);
+                found = (void*)(uintptr_t)(slot + 1);
+            }
+            m_unique(TEXTURES->name_to_slot, name, found);
+        }
+        pthread_mutex_unlock(&TEXTURES->lock);
+        stbi_image_free(png);
+    }
+
+    if (found == MISSING_TEXTURE) {
+        return NULL;
+    }
+    return TEXTURES->pixels + ((uintptr_t)found - 1) * TEXTURE_BYTES;
+}
+
+int is_grass_or_tall_grass(char* block_minecraft_name) {
+    return strstr(block_minecraft_name, "grass") != NULL;
+}
+
+int is_fluid(char* block_minecraft_name) {
+    return strcmp(block_minecraft_name, "minecraft:water") == 0 || strcmp(block_minecraft_name, "minecraft:bubble_column") == 0;
+}
+
+int is_leaves(char* block_minecraft_name) {
+    return strstr(block_minecraft_name, "leaves") != NULL;
+}
+
+
+typedef struct {
+    uint8_t* pixels; // NULL if the jar doesn't have it
+    int width;
+    int height;
+} Colormap;
+
+Colormap GRASS_COLORMAP;
+Colormap FOLIAGE_COLORMAP;
+Colormap DRY_FOLIAGE_COLORMAP;
+
+Pixel WHITE = {255, 255, 255, 255};
+
+Colormap load_colormap(const char* name) {
+    Colormap colormap;
+    char* path = CAT(TEXTURE_PATH, "colormap/", (char*)name, ".png", NULL);
+    colormap.pixels = load_png_asset(path, &colormap.width, &colormap.height);
+    free(path);
+    return colormap;
+}
+
+Pixel rgb_to_pixel(int rgb) {
+    Pixel pixel = {(rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF, 255};
+    return pixel;
+}
+
+double clamp_01(double value) {
+    return value < 0? 0 : value > 1? 1 : value;
+}
+
+/**
+ * Looks a biome's color up in a colormap the way the game does. Temperature runs right to
+ * left and downfall (scaled by temperature) bottom to top, so the colormap is a triangle.
+ */
+Pixel colormap_color(Colormap* colormap, Biome* biome) {
+    if (colormap->pixels == NULL) {
+        return WHITE;
+    }
+
+    double temperature = clamp_01(biome->temperature);
+    double downfall = clamp_01(biome->downfall) * temperature;
+    int x = (int)((1.0 - temperature) * (colormap->width - 1));
+    int y = (int)((1.0 - downfall) * (colormap->height - 1));
+
+    int index = pixel_index(x, y, colormap->width);
+    Pixel pixel = {colormap->pixels[index], colormap->pixels[index+1], colormap->pixels[index+2], 255};
+    return pixel;
+}
+
+// works out a biome's tints from its colormap position and overrides
+void init_biome_tint(Biome* biome) {
+    Pixel grass = biome->grass_color != -1? rgb_to_pixel(biome->grass_color) : colormap_color(&GRASS_COLORMAP, biome);
+    if (biome->grass_color_modifier == GRASS_MODIFIER_DARK_FOREST) {
+        int rgb = (grass.r << 16) | (grass.g << 8) | grass.b;
+        grass = rgb_to_pixel(((rgb & 0xFEFEFE) + 0x28340A) >> 1);
+    }
+    else if (biome->grass_color_modifier == GRASS_MODIFIER_SWAMP) {
+        grass = rgb_to_pixel(0x6A7039); // the game picks between two colors with noise, this is the common one
+    }
+
+    Pixel dry_foliage = biome->dry_foliage_color != -1? rgb_to_pixel(biome->dry_foliage_color) : colormap_color(&DRY_FOLIAGE_COLORMAP, biome);
+
+    biome->tints[TINT_NONE] = WHITE;
+    biome->tints[TINT_GRASS] = grass;
+    biome->tints[TINT_FOLIAGE] = biome->foliage_color != -1? rgb_to_pixel(biome->foliage_color) : colormap_color(&FOLIAGE_COLORMAP, biome);
+    biome->tints[TINT_WATER] = biome->water_color != -1? rgb_to_pixel(biome->water_color) : WHITE;
+    biome->tints[TINT_DRY_FOLIAGE] = biome->downfall == 0? dry_foliage : WHITE;
+}
+
+/**
+ * Loads the colormaps and works out the tints of every biome in 'BIOMES' and the default biome.
+ */
+void init_biome_tints() {
+    GRASS_COLORMAP = load_colormap("grass");
+    FOLIAGE_COLORMAP = load_colormap("foliage");
+    DRY_FOLIAGE_COLORMAP = load_colormap("dry_foliage");
+
+    for (int id = 0; id < BIOMES_LEN; id++) {
+        init_biome_tint(&BIOMES[id]);
+    }
+    init_biome_tint(&DEFAULT_BIOME);
+}
+
+/**
+ * The tint class of the block's tinted faces (ones with a 'tintindex'), the color itself comes
+ * from the biome's 'tints'.
+ */
+TintClass block_tint_class(char* block_minecraft_name) {
+    if (is_grass_or_tall_grass(block_minecraft_name)) {
+        return TINT_GRASS;
+    }
+    else if (is_fluid(block_minecraft_name)) {
+        return TINT_WATER;
+    }
+    else if (is_leaves(block_minecraft_name)) {
+        return TINT_FOLIAGE;
+    }
+    return TINT_DRY_FOLIAGE;
+}
+
+// MODELS
+
+#define FACE_DOWN 0
+#define FACE_UP 1
+#define FACE_NORTH 2
+#define FACE_SOUTH 3
+#define FACE_WEST 4
+#define FACE_EAST 5
+#define FACE_COUNT 6
+
+const char* FACE_NAMES[FACE_COUNT] = {"down", "up", "north", "south", "west", "east"};
+
+// the faces drawn as the left and right squares of a sprite, by side (see 'set_left_square')
+const int LEFT_FACES[4] = {FACE_WEST, FACE_SOUTH, FACE_EAST, FACE_NORTH};
+const int RIGHT_FACES[4] = {FACE_SOUTH, FACE_EAST, FACE_NORTH, FACE_WEST};
+
+/**
+ * A model file as written, parsed once. Texture references ('#side') are left as they are
+ * since children can fill them in.
+ */
+typedef struct {
+    char* texture; // NULL when the element doesn't have the face
+    int tint_index; // -1 when the face isn't tinted
+} ModelFace;
+
+typedef struct {
+    float from[3];
+    float to[3];
+    ModelFace faces[FACE_COUNT];
+} ModelElement;
+
+typedef struct Model {
+    struct Model* parent;
+
+    Property* textures; // texture variables this file sets
+    int texture_count;
+
+    ModelElement* elements;
+    int element_count;
+    int has_elements; // otherwise the elements come from the parent
+} Model;
+
+/**
+ * A model with its parent chain flattened and texture variables resolved to atlas pixels.
+ * This is all sprite building needs.
+ */
+typedef struct {
+    uint8_t* texture; // atlas pixels, NULL when the element doesn't have the face
+    int tint_index; // -1 when the face isn't tinted
+} ResolvedFace;
+
+typedef struct {
+    float from[3];
+    float to[3];
+    ResolvedFace faces[FACE_COUNT];
+} ResolvedElement;
+
+typedef struct {
+    ResolvedElement* elements;
+    int element_count; // 0 when the model couldn't be found
+} ResolvedModel;
+
+Map* MODELS = NULL; // 'block/cube_all' -> Model*, or MISSING_MODEL
+Map* RESOLVED_MODELS = NULL; // 'block/stone' -> ResolvedModel*
+pthread_mutex_t MODELS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+#define MISSING_MODEL ((void*)(uintptr_t)-1)
+#define MAX_MODEL_DEPTH 32 // longest parent chain or '#variable' chain followed
+
+// 'minecraft:block/stone' -> 'block/stone'
+const char* strip_namespace(const char* name) {
+    const char* colon = strchr(name, ':');
+    return colon != NULL? colon + 1 : name;
+}
+
+void read_vector(cJSON* array, float out[3]) {
+    for (int i = 0; i < 3; i++) {
+        cJSON* value = cJSON_GetArrayItem(array, i);
+        out[i] = cJSON_IsNumber(value)? (float)value->valuedouble : 0;
+    }
+}
+
+Model* get_model(const char* model_name, int depth);
+
+/**
+ * Parses a model file and its parents. Call with 'MODELS_LOCK' held. Returns NULL if the jar
+ * doesn't have it.
+ */
+Model* get_model(const char* model_name, int depth) {
+    const char* name = strip_namespace(model_name);
+    void* found = m_get(MODELS, (char*)name);
+    if (found != NULL) {
+        return found == MISSING_MODEL? NULL : found;
+    }
+
+    char* path = CAT(MODELS_PATH, (char*)name, ".json", NULL);
+    char* content = read_asset(path, NULL);
+    free(path);
+    cJSON* json = content != NULL? cJSON_Parse(content) : NULL;
+    free(content);
+    if (json == NULL) {
+        m_unique(MODELS, (char*)name, MISSING_MODEL);
+        return NULL;
+    }
+
+    Model* model = calloc(1, sizeof(Model));
+    m_unique(MODELS, (char*)name, model);
+
+    // TEXTURE VARIABLES
+    cJSON* textures = cJSON_GetObjectItem(json, "textures");
+    if (cJSON_IsObject(textures)) {
+        model->textures = malloc(cJSON_GetArraySize(textures) * sizeof(Property));
+        cJSON* texture;
+        cJSON_ArrayForEach(texture, textures) {
+            if (!cJSON_IsString(texture)) continue;
+            model->textures[model->texture_count].key = strdup(texture->string);
+            model->textures[model->texture_count].value = strdup(texture->valuestring);
+            model->texture_count++;
+        }
+    }
+
+    // ELEMENTS
+    cJSON* elements = cJSON_GetObjectItem(json, "elements");
+    if (cJSON_IsArray(elements)) {
+        model->has_elements = 1;
+        model->elements = calloc(cJSON_GetArraySize(elements), sizeof(ModelElement));
+        cJSON* element_json;
+        cJSON_ArrayForEach(element_json, elements) {
+            ModelElement* element = &model->elements[model->element_count++];
+            read_vector(cJSON_GetObjectItem(element_json, "from"), element->from);
+            read_vector(cJSON_GetObjectItem(element_json, "to"), element->to);
+
+            cJSON* faces = cJSON_GetObjectItem(element_json, "faces");
+            for (int f = 0; f < FACE_COUNT; f++) {
+                cJSON* face = cJSON_GetObjectItem(faces, FACE_NAMES[f]);
+                cJSON* texture = cJSON_GetObjectItem(face, "texture");
+                cJSON* tint_index = cJSON_GetObjectItem(face, "tintindex");
+                element->faces[f].texture = cJSON_IsString(texture)? strdup(texture->valuestring) : NULL;
+                element->faces[f].tint_index = cJSON_IsNumber(tint_index)? tint_index->valueint : -1;
+            }
+        }
+    }
+
+    // PARENT
+    cJSON* parent = cJSON_GetObjectItem(json, "parent");
+    if (cJSON_IsString(parent) && depth < MAX_MODEL_DEPTH) {
+        model->parent = get_model(parent->valuestring, depth + 1);
+    }
+
+    cJSON_Delete(json);
+    return model;
+}
+
+/**
+ * Follows a texture reference like '#side' through the model's variables (children first)
+ * to a texture name. Returns NULL if it never reaches one.
+ */
+const char* resolve_texture_reference(Model* model, const char* reference) {
+    for (int depth = 0; reference != NULL && reference[0] == '#' && depth < MAX_MODEL_DEPTH; depth++) {
+        const char* variable = reference + 1;
+        reference = NULL;
+
+        Model* m = model;
+        for (int d = 0; m != NULL && reference == NULL && d < MAX_MODEL_DEPTH; m = m->parent, d++) {
+            for (int i = 0; i < m->texture_count; i++) {
+                if (strcmp(m->textures[i].key, variable) == 0) {
+                    reference = m->textures[i].value;
+                    break;
+                }
+            }
+        }
+    }
+
+    return (reference != NULL && reference[0] != '#')? reference : NULL;
+}
+
+// water and lava models are only a particle texture, the game draws fluids itself
+ResolvedModel* fluid_model(const char* model_name) {
+    const char* texture = NULL;
+    int tint_index = -1;
+    if (strcmp(model_name, "block/water") == 0 || strcmp(model_name, "block/bubble_column") == 0) {
+        texture = "block/water_still";
+        tint_index = 0;
+    }
+    else if (strcmp(model_name, "block/lava") == 0) {
+        texture = "block/lava_still";
+    }
+    uint8_t* pixels = texture != NULL? load_texture((char*)texture) : NULL;
+    if (pixels == NULL) {
+        return NULL;
+    }
+
+    ResolvedModel* resolved = malloc(sizeof(ResolvedModel));
+    resolved->element_count = 1;
+    resolved->elements = calloc(1, sizeof(ResolvedElement));
+    ResolvedElement* element = resolved->elements;
+    element->to[0] = 16;
+    element->to[1] = 14; // fluids sit a little below a full block
+    element->to[2] = 16;
+    for (int f = 0; f < FACE_COUNT; f++) {
+        element->faces[f].texture = pixels;
+        element->faces[f].tint_index = tint_index;
+    }
+    return resolved;
+}
+
+/**
+ * Returns the resolved model ('block/stone' or 'minecraft:block/stone'). Every model file is
+ * parsed once and every model resolved once. Models the jar doesn't have come back with no
+ * elements.
+ */
+ResolvedModel* get_resolved_model(const char* model_name) {
+    const char* name = strip_namespace(model_name);
+
+    pthread_mutex_lock(&MODELS_LOCK);
+    if (MODELS == NULL) {
+        MODELS = new_map();
+        RESOLVED_MODELS = new_map();
+    }
+
+    ResolvedModel* resolved = m_get(RESOLVED_MODELS, (char*)name);
+    if (resolved == NULL) {
+        Model* model = get_model(name, 0);
+
+        // the elements come from the closest model in the chain that has them
+        Model* with_elements = model;
+        for (int d = 0; with_elements != NULL && !with_elements->has_elements && d < MAX_MODEL_DEPTH; d++) {
+            with_elements = with_elements->parent;
+        }
+
+        if (with_elements == NULL || !with_elements->has_elements || with_elements->element_count == 0) {
+            resolved = fluid_model(name);
+        }
+        if (resolved == NULL) {
+            resolved = calloc(1, sizeof(ResolvedModel));
+        }
+
+        if (with_elements != NULL && with_elements->has_elements && resolved->element_count == 0) {
+            resolved->element_count = with_elements->element_count;
+            resolved->elements = calloc(resolved->element_count, sizeof(ResolvedElement));
+            for (int i = 0; i < resolved->element_count; i++) {
+                ModelElement* element = &with_elements->elements[i];
+                memcpy(resolved->elements[i].from, element->from, sizeof(element->from));
+                memcpy(resolved->elements[i].to, element->to, sizeof(element->to));
+                for (int f = 0; f < FACE_COUNT; f++) {
+                    const char* texture = element->faces[f].texture != NULL? resolve_texture_reference(model, element->faces[f].texture) : NULL;
+                    resolved->elements[i].faces[f].texture = texture != NULL? load_texture((char*)texture) : NULL;
+                    resolved->elements[i].faces[f].tint_index = element->faces[f].tint_index;
+                }
+            }
+        }
+
+        m_unique(RESOLVED_MODELS, (char*)name, resolved);
+    }
+    pthread_mutex_unlock(&MODELS_LOCK);
+
+    return resolved;
+}
+
+
+// BLOCKSTATES
+
+/**
+ * A blockstate file ('assets/minecraft/blockstates/oak_log.json') compiled into cases, each a
+ * model and rotation plus the property values it applies to. Every file is compiled once at
+ * startup, then each block state id is matched against its block's cases once and the result
+ * kept on the state, so drawing a state is an array lookup.
+ */
+typedef struct {
+    char* key;
+    char** values; // any of these ('north|south' in the file)
+    int value_count;
+} StateCondition;
+
+typedef struct {
+    StateCondition* conditions; // all of these
+    int condition_count;
+} StateWhen;
+
+typedef struct {
+    StateWhen* when; // any of these, none means always
+    int when_count;
+
+    char* model;
+    int x; // rotations in degrees, multiples of 90
+    int y;
+} StateCase;
+
+typedef struct {
+    StateCase* cases;
+    int case_count;
+    int multipart; // every matching case is drawn, otherwise only the first ('variants')
+} BlockStateDefinition;
+
+typedef struct StateModel {
+    ResolvedModel** parts; // rotated, drawn in order
+    int part_count;
+    uint64_t signature; // of the block and the cases that matched, states that look the same share it
+} StateModel;
+
+Map* BLOCK_STATE_DEFINITIONS = NULL; // 'oak_log' -> BlockStateDefinition*
+pthread_mutex_t BLOCK_STATE_MODELS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+void add_state_condition(StateWhen* when, const char* key, const char* values) {
+    StateCondition* condition = &when->conditions[when->condition_count++];
+    condition->key = strdup(key);
+    condition->values = split((char*)values, "|", &condition->value_count);
+}
+
+// 'facing=east,half=bottom' (variants key)
+StateWhen parse_variant_key(const char* variant) {
+    StateWhen when = {0};
+    int count;
+    char** pairs = split((char*)variant, ",", &count);
+    when.conditions = malloc((count + 1) * sizeof(StateCondition));
+    for (int i = 0; i < count; i++) {
+        char* equals = strchr(pairs[i], '=');
+        if (equals != NULL) { // old files use 'normal' for blocks without properties
+            *equals = '\0';
+            add_state_condition(&when, pairs[i], equals + 1);
+        }
+    }
+    free_array((void**)pairs, count);
+    return when;
+}
+
+// {"facing": "north", "up": "true|false"} (multipart 'when'), an 'AND' list adds every entry's conditions
+void add_when_object(StateWhen* when, cJSON* object) {
+    when->conditions = realloc(when->conditions, (when->condition_count + cJSON_GetArraySize(object) + 1) * sizeof(StateCondition));
+    cJSON* value;
+    cJSON_ArrayForEach(value, object) {
+        if (cJSON_IsString(value)) {
+            add_state_condition(when, value->string, value->valuestring);
+        }
+        else if (cJSON_IsBool(value)) {
+            add_state_condition(when, value->string, cJSON_IsTrue(value)? "true" : "false");
+        }
+        else if (cJSON_IsNumber(value)) { // 'age': 7, properties are always integers
+            char number[32];
+            snprintf(number, sizeof(number), "%d", value->valueint);
+            add_state_condition(when, value->string, number);
+        }
+        else if (cJSON_IsArray(value) && strcmp(value->string, "AND") == 0) {
+            cJSON* entry;
+            cJSON_ArrayForEach(entry, value) {
+                if (cJSON_IsObject(entry)) add_when_object(when, entry);
+            }
+        }
+    }
+}
+
+StateWhen parse_when_object(cJSON* object) {
+    StateWhen when = {0};
+    add_when_object(&when, object);
+    return when;
+}
+
+// weighted lists pick one model at random in game, a map always draws the first
+void read_state_model(cJSON* json, StateCase* out) {
+    if (cJSON_IsArray(json)) {
+        json = cJSON_GetArrayItem(json, 0);
+    }
+    cJSON* model = cJSON_GetObjectItem(json, "model");
+    cJSON* x = cJSON_GetObjectItem(json, "x");
+    cJSON* y = cJSON_GetObjectItem(json, "y");
+    out->model = strdup(cJSON_IsString(model)? strip_namespace(model->valuestring) : "");
+    out->x = cJSON_IsNumber(x)? x->valueint : 0;
+    out->y = cJSON_IsNumber(y)? y->valueint : 0;
+}
+
+BlockStateDefinition* compile_block_state_definition(cJSON* json) {
+    BlockStateDefinition* definition = calloc(1, sizeof(BlockStateDefinition));
+
+    cJSON* variants = cJSON_GetObjectItem(json, "variants");
+    cJSON* multipart = cJSON_GetObjectItem(json, "multipart");
+    if (cJSON_IsObject(variants)) {
+        definition->cases = calloc(cJSON_GetArraySize(variants) + 1, sizeof(StateCase));
+        cJSON* variant;
+        cJSON_ArrayForEach(variant, variants) {
+            StateCase* state_case = &definition->cases[definition->case_count++];
+            state_case->when = malloc(sizeof(StateWhen));
+            state_case->when[0] = parse_variant_key(variant->string);
+            state_case->when_count = 1;
+            read_state_model(variant, state_case);
+        }
+    }
+    else if (cJSON_IsArray(multipart)) {
+        definition->multipart = 1;
+        definition->cases = calloc(cJSON_GetArraySize(multipart) + 1, sizeof(StateCase));
+        cJSON* part;
+        cJSON_ArrayForEach(part, multipart) {
+            StateCase* state_case = &definition->cases[definition->case_count++];
+            read_state_model(cJSON_GetObjectItem(part, "apply"), state_case);
+
+            cJSON* when = cJSON_GetObjectItem(part, "when");
+            cJSON* any = cJSON_GetObjectItem(when, "OR");
+            if (!cJSON_IsArray(any)) {
+                any = NULL;
+            }
+            if (any != NULL) {
+                state_case->when = malloc((cJSON_GetArraySize(any) + 1) * sizeof(StateWhen));
+                cJSON* option;
+                cJSON_ArrayForEach(option, any) {
+                    state_case->when[state_case->when_count++] = parse_when_object(option);
+                }
+            }
+            else if (cJSON_IsObject(when)) {
+                state_case->when = malloc(sizeof(StateWhen));
+                state_case->when[0] = parse_when_object(when);
+                state_case->when_count = 1;
+            }
+        }
+    }
+
+    return definition;
+}
+
+/**
+ * Compiles every blockstate file in the jar.
+ */
+void load_block_state_definitions() {
+    int count;
+    char** paths = list_assets(BLOCKSTATES_PATH, ".json", &count);
+    BLOCK_STATE_DEFINITIONS = new_map_reserved(count);
+
+    for (int i = 0; i < count; i++) {
+        char* content = read_asset(paths[i], NULL);
+        cJSON* json = content != NULL? cJSON_Parse(content) : NULL;
+        free(content);
+        if (json == NULL) {
+            printf("%sCouldn't parse %s%s\n", YELLOW, paths[i], RESET);
+            continue;
+        }
+
+        // 'assets/minecraft/blockstates/oak_log.json' -> 'oak_log'
+        char name[256];
+        const char* start = paths[i] + strlen(BLOCKSTATES_PATH);
+        snprintf(name, sizeof(name), "%.*s", (int)(strlen(start) - strlen(".json")), start);
+        m_unique(BLOCK_STATE_DEFINITIONS, name, compile_block_state_definition(json));
+
+        cJSON_Delete(json);
+    }
+    free(paths);
+}
+
+int state_when_matches(StateWhen* when, BlockState* state) {
+    for (int i = 0; i < when->condition_count; i++) {
+        StateCondition* condition = &when->conditions[i];
+        char* value = find_property(state, condition->key);
+        if (value == NULL) return 0;
+
+        int matches = 0;
+        for (int v = 0; v < condition->value_count && !matches; v++) {
+            matches = strcmp(condition->values[v], value) == 0;
+        }
+        if (!matches) return 0;
+    }
+    return 1;
+}
+
+int state_case_matches(StateCase* state_case, BlockState* state) {
+    if (state_case->when_count == 0) return 1;
+    for (int i = 0; i < state_case->when_count; i++) {
+        if (state_when_matches(&state_case->when[i], state)) return 1;
+    }
+    return 0;
+}
+
+// turns a point a quarter turn around the block's center, x first as the game does
+void rotate_point_x(float* p) {
+    float y = p[1];
+    p[1] = p[2];
+    p[2] = 16 - y;
+}
+
+void rotate_point_y(float* p) {
+    float x = p[0];
+    p[0] = 16 - p[2];
+    p[2] = x;
+}
+
+/**
+ * Returns a copy of 'model' turned 'x' then 'y' degrees. Faces move with the elements, so a
+ * log's 'up' face ends up facing north or east.
+ */
+ResolvedModel* rotate_model(ResolvedModel* model, int x, int y) {
+    ResolvedModel* rotated = malloc(sizeof(ResolvedModel));
+    rotated->element_count = model->element_count;
+    rotated->elements = malloc((model->element_count + 1) * sizeof(ResolvedElement));
+
+    int x_turns = ((x / 90) % 4 + 4) % 4;
+    int y_turns = ((y / 90) % 4 + 4) % 4;
+    for (int i = 0; i < model->element_count; i++) {
+        ResolvedElement element = model->elements[i];
+
+        for (int t = 0; t < x_turns; t++) {
+            rotate_point_x(element.from);
+            rotate_point_x(element.to);
+            ResolvedFace up = element.faces[FACE_UP];
+            element.faces[FACE_UP] = element.faces[FACE_SOUTH];
+            element.faces[FACE_SOUTH] = element.faces[FACE_DOWN];
+            element.faces[FACE_DOWN] = element.faces[FACE_NORTH];
+            element.faces[FACE_NORTH] = up;
+        }
+        for (int t = 0; t < y_turns; t++) {
+            rotate_point_y(element.from);
+            rotate_point_y(element.to);
+            ResolvedFace north = element.faces[FACE_NORTH];
+            element.faces[FACE_NORTH] = element.faces[FACE_WEST];
+            element.faces[FACE_WEST] = element.faces[FACE_SOUTH];
+            element.faces[FACE_SOUTH] = element.faces[FACE_EAST];
+            element.faces[FACE_EAST] = north;
+        }
+
+        // turning swaps which corner is smallest
+        for (int a = 0; a < 3; a++) {
+            if (element.from[a] > element.to[a]) {
+                float from = element.from[a];
+                element.from[a] = element.to[a];
+                element.to[a] = from;
+            }
+        }
+        rotated->elements[i] = element;
+    }
+
+    return rotated;
+}
+
+/**
+ * Returns the resolved model turned by a blockstate rotation. Each model and rotation is only
+ * built once.
+ */
+ResolvedModel* get_rotated_model(const char* model_name, int x, int y) {
+    ResolvedModel* model = get_resolved_model(model_name);
+    if ((x % 360 == 0 && y % 360 == 0) || model->element_count == 0) {
+        return model;
+    }
+
+    char key[512];
+    snprintf(key, sizeof(key), "%s@%d,%d", strip_namespace(model_name), x, y);
+
+    pthread_mutex_lock(&MODELS_LOCK);
+    ResolvedModel* rotated = m_get(RESOLVED_MODELS, key);
+    if (rotated == NULL) {
+        rotated = rotate_model(model, x, y);
+        m_unique(RESOLVED_MODELS, key, rotated);
+    }
+    pthread_mutex_unlock(&MODELS_LOCK);
+
+    return rotated;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void* bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ ((const uint8_t*)bytes)[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Matches a block state against its block's blockstate file. Blocks without one fall back to
+ * the model named after the block.
+ */
+StateModel* match_state_model(BlockState* state) {
+    StateModel* state_model = calloc(1, sizeof(StateModel));
+    const char* name = strip_namespace(state->name);
+    state_model->signature = hash_bytes(14695981039346656037ULL, name, strlen(name) + 1);
+
+    BlockStateDefinition* definition = BLOCK_STATE_DEFINITIONS != NULL? m_get(BLOCK_STATE_DEFINITIONS, (char*)name) : NULL;
+    if (definition != NULL) {
+        state_model->parts = malloc((definition->case_count + 1) * sizeof(ResolvedModel*));
+        for (int i = 0; i < definition->case_count; i++) {
+            StateCase* state_case = &definition->cases[i];
+            if (!state_case_matches(state_case, state)) continue;
+
+            state_model->parts[state_model->part_count++] = get_rotated_model(state_case->model, state_case->x, state_case->y);
+            state_model->signature = hash_bytes(state_model->signature, &i, sizeof(i));
+            if (!definition->multipart) break;
+        }
+    }
+    else {
+        char model_name[256];
+        snprintf(model_name, sizeof(model_name), "block/%s", name);
+        state_model->parts = malloc(sizeof(ResolvedModel*));
+        state_model->parts[state_model->part_count++] = get_resolved_model(model_name);
+        state_model->signature = hash_bytes(state_model->signature, "*", 1);
+    }
+
+    return state_model;
+}
+
+/**
+ * Returns the models to draw for a block state (see 'block_state_id').
+ */
+StateModel* get_state_model(uint32_t block_state) {
+    BlockState* state = get_block_state(block_state);
+
+    pthread_mutex_lock(&BLOCK_STATE_MODELS_LOCK);
+    StateModel* state_model = state->model;
+    pthread_mutex_unlock(&BLOCK_STATE_MODELS_LOCK);
+    if (state_model != NULL) {
+        return state_model;
+    }
+
+    state_model = match_state_model(state);
+
+    // another thread may have got here first, keep theirs
+    pthread_mutex_lock(&BLOCK_STATE_MODELS_LOCK);
+    if (state->model == NULL) {
+        state->model = state_model;
+    }
+    else {
+        free(state_model->parts);
+        free(state_model);
+    }
+    state_model = state->model;
+    pthread_mutex_unlock(&BLOCK_STATE_MODELS_LOCK);
+
+    return state_model;
+}
+
+
+// NULL if none of the tint classes are set, otherwise 'tints'
+static uint8_t* used_tints(uint8_t* tints) {
+    for (int p = 0; p < 16*16; p++) {
+        if (tints[p] != TINT_NONE) return tints;
+    }
+    return NULL;
+}
+
+// frees a side's tint classes if none are set
+static uint8_t* keep_used_tints(uint8_t* tints) {
+    if (used_tints(tints) == NULL) {
+        free(tints);
+        return NULL;
+    }
+    return tints;
+}
+
+/**
+ * Renders the pixels (16x16) for every side of a block's model. Tinted pixels are left gray and
+ * marked with the block's tint class (see 'block_tint_class'), the biome colors them when
+ * they're put on the map.
+ * 
+ * Blank pixels are set as -1.
+ */
+RenderedBlock* render_state_model(StateModel* model, char* block_minecraft_name) {
+    // elements of every part of the model, in order
+    int element_count = 0;
+    for (int p = 0; p < model->part_count; p++) {
+        element_count += model->parts[p]->element_count;
+    }
+    ResolvedElement* elements[element_count + 1];
+    for (int p = 0, e = 0; p < model->part_count; p++) {
+        for (int i = 0; i < model->parts[p]->element_count; i++) {
+            elements[e++] = &model->parts[p]->elements[i];
+        }
+    }
+
+    RenderedBlock* block = calloc(1, sizeof(RenderedBlock));
+    block->pixels_0 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
+    block->pixels_1 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
+    block->pixels_2 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
+    block->pixels_3 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
+    block->tints_0 = (uint8_t *)calloc(16*16, sizeof(uint8_t));
+    block->tints_1 = (uint8_t *)calloc(16*16, sizeof(uint8_t));
+    block->tints_2 = (uint8_t *)calloc(16*16, sizeof(uint8_t));
+    block->tints_3 = (uint8_t *)calloc(16*16, sizeof(uint8_t));
+
+    // RENDER each orientation
+    if (element_count > 0) {
+        TintClass tint_class = block_tint_class(block_minecraft_name);
+
+        for (int side = 0; side < 4; side++) {
+
+            uint8_t* pixels;
+            uint8_t* tints;
+            if (side == 0) {
+                pixels = block->pixels_0;
+                tints = block->tints_0;
+            }
+            else if (side == 1) {
+                pixels = block->pixels_1;
+                tints = block->tints_1;
+            }
+            else if (side == 2) {
+                pixels = block->pixels_2;
+                tints = block->tints_2;
+            }
+            else {
+                pixels = block->pixels_3;
+                tints = block->tints_3;
+            }
+
+            for (int e = 0; e < element_count; e++) {
+                ResolvedElement* element = elements[e];
+                ResolvedFace* top = &element->faces[FACE_UP];
+                ResolvedFace* left = &element->faces[LEFT_FACES[side]];
+                ResolvedFace* right = &element->faces[RIGHT_FACES[side]];
+
+                // top square
+                uint8_t top_pixels[16*16*4] = {0};
+                if (top->texture != NULL) {
+                    set_top_square(top_pixels, side, top->texture, element->from, element->to);
+                }
+
+
+                // left square
+                uint8_t left_pixels[16*16*4] = {0};
+                if (left->texture != NULL) {
+                    set_left_square(left_pixels, side, left->texture, NULL, element->from, element->to);
+                }
+                
+
+                // right square
+                uint8_t right_pixels[16*16*4] = {0};
+                if (right->texture != NULL) {
+                    set_right_square(right_pixels, side, right->texture, NULL, element->from, element->to);
+                }
+
+                composite_tint_classes(tints, top_pixels, top->tint_index >= 0? tint_class : TINT_NONE, 16*16);
+                composite_tint_classes(tints, left_pixels, left->tint_index >= 0? tint_class : TINT_NONE, 16*16);
+                composite_tint_classes(tints, right_pixels, right->tint_index >= 0? tint_class : TINT_NONE, 16*16);
+                combine_images(pixels, top_pixels, left_pixels, right_pixels, 16);
+
+            }
+        }
+    }
+    else {
+        printf("%sCouldn't find block model for '%s' so we'll just use the default block for that one.%s\n", YELLOW, block_minecraft_name, RESET);
+        // XXX: actually do that here
+    }
+
+    // most blocks aren't tinted at all, they're blitted without the tint pass
+    block->tints_0 = keep_used_tints(block->tints_0);
+    block->tints_1 = keep_used_tints(block->tints_1);
+    block->tints_2 = keep_used_tints(block->tints_2);
+    block->tints_3 = keep_used_tints(block->tints_3);
+
+    return block;
+}
+
+
+// RENDER PACK
+
+/**
+ * Every block sprite of a jar rendered ahead of time ('--build-render-pack') into one file in
+ * the asset cache, mapped read only at startup and shared by every thread.
+ *
+ * Layout: a header, the sprites ('RENDER_PACK_SPRITE_BYTES' each: the pixels of every side of a
+ * block one after another, then the tint classes of every side) starting on an aligned offset,
+ * then an index sorted by state model signature (see 'match_state_model').
+ */
+#define RENDER_PACK_MAGIC "MDMPACK"
+#define RENDER_PACK_ALIGNMENT 4096
+#define SIDE_PIXEL_BYTES (16*16*4)
+#define SIDE_TINT_BYTES (16*16)
+#define RENDER_PACK_SPRITE_BYTES (4 * SIDE_PIXEL_BYTES + 4 * SIDE_TINT_BYTES)
+#define MAX_PACK_COMBINATIONS 4096 // blocks with more property combinations than this are rendered live
+
+typedef struct {
+    char magic[8];
+    uint32_t version; // MAPPER_VERSION
+    uint32_t sprite_bytes;
+    uint64_t jar_hash;
+    uint64_t entry_count;
+    uint64_t data_offset;
+    uint64_t index_offset;
+} RenderPackHeader;
+
+typedef struct {
+    uint64_t signature;
+    uint64_t offset; // from 'data_offset'
+} RenderPackEntry;
+
+typedef struct {
+    uint8_t* data; // the mapped file
+    size_t size;
+    RenderPackHeader* header;
+    RenderPackEntry* entries;
+} RenderPack;
+
+RenderPack* RENDER_PACK = NULL;
+
+int compare_pack_entries(const void* a, const void* b) {
+    uint64_t sa = ((RenderPackEntry*)a)->signature;
+    uint64_t sb = ((RenderPackEntry*)b)->signature;
+    return sa < sb? -1 : sa > sb;
+}
+
+/**
+ * Whether the index and every sprite it points at lie inside a pack of 'size' bytes, so a
+ * damaged pack is turned away when it's opened instead of read past its end later.
+ */
+static int render_pack_in_bounds(RenderPackHeader* header, size_t size) {
+    if (header->data_offset > header->index_offset
+        || header->index_offset > size
+        || header->index_offset % sizeof(uint64_t) != 0
+        || header->entry_count > (size - header->index_offset) / sizeof(RenderPackEntry)) {
+        return 0;
+    }
+
+    uint64_t data_bytes = header->index_offset - header->data_offset;
+    RenderPackEntry* entries = (RenderPackEntry*)((uint8_t*)header + header->index_offset);
+    for (uint64_t i = 0; i < header->entry_count; i++) {
+        if (data_bytes < RENDER_PACK_SPRITE_BYTES || entries[i].offset > data_bytes - RENDER_PACK_SPRITE_BYTES) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Maps the cache's render pack if it has one. Returns NULL if not or if it doesn't match the
+ * jar.
+ */
+RenderPack* open_render_pack(AssetCache* cache) {
+    if (!cache->render_pack) {
+        return NULL;
+    }
+
+    char path[1024 + 32];
+    snprintf(path, sizeof(path), "%s/render.pack", cache->dir);
+    size_t size = 0;
+    uint8_t* data = map_file(path, &size);
+    if (data == NULL) {
+        printf("%sCouldn't open render pack '%s', rendering live%s\n", YELLOW, path, RESET);
+        return NULL;
+    }
+    if (size < sizeof(RenderPackHeader)) {
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    RenderPackHeader* header = (RenderPackHeader*)data;
+    if (memcmp(header->magic, RENDER_PACK_MAGIC, sizeof(header->magic)) != 0
+        || header->version != MAPPER_VERSION
+        || header->sprite_bytes != RENDER_PACK_SPRITE_BYTES
+        || header->jar_hash != strtoull(cache->jar_hash, NULL, 16)) {
+        printf("%sRender pack '%s' doesn't match the jar, ignoring it%s\n", YELLOW, path, RESET);
+        unmap_file(data, size);
+        return NULL;
+    }
+    if (!render_pack_in_bounds(header, size)) {
+        printf("%sRender pack '%s' is damaged, ignoring it%s\n", YELLOW, path, RESET);
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    RenderPack* pack = malloc(sizeof(RenderPack));
+    pack->data = data;
+    pack->size = size;
+    pack->header = header;
+    pack->entries = (RenderPackEntry*)(data + header->index_offset);
+    printf("Using render pack with %llu blocks\n", (unsigned long long)header->entry_count);
+    return pack;
+}
 
-    printf("\n");
-    model_y_end = model_y_end == 0? -1 : model_y_end;
-    model_h_end = model_h_end == 0? -1 : model_h_end;
-    for (int y = model_y_start; y != model_y_end; y+=y_step) {
-        for (int h = model_h_start; h != model_h_end; h+=h_step) {
-            if (h == model_h_end) continue;
-            if (y == model_y_end) continue;
-            
-            // convert to image coordinates
-            int image_x, image_y;
-            if (model_x_start == model_x_end) {
-                model_x_y_z_to_image_x_y(model_x_start, y, h, &image_x, &image_y);
-            }
-            else {
-                model_x_y_z_to_image_x_y(h, y, model_z_start, &image_x, &image_y);
-            }
+// a block's sprites pointing into a render pack or sprite cache record
+RenderedBlock* record_rendered_block(uint8_t* record) {
+    uint8_t* tints = record + 4 * SIDE_PIXEL_BYTES;
+    RenderedBlock* block = calloc(1, sizeof(RenderedBlock));
+    block->pixels_0 = record;
+    block->pixels_1 = record + SIDE_PIXEL_BYTES;
+    block->pixels_2 = record + 2 * SIDE_PIXEL_BYTES;
+    block->pixels_3 = record + 3 * SIDE_PIXEL_BYTES;
+    block->tints_0 = used_tints(tints);
+    block->tints_1 = used_tints(tints + SIDE_TINT_BYTES);
+    block->tints_2 = used_tints(tints + 2 * SIDE_TINT_BYTES);
+    block->tints_3 = used_tints(tints + 3 * SIDE_TINT_BYTES);
+    return block;
+}
 
-            // skip out of bounds stuff
-            if (image_x == 16 || image_y == 16 || image_x == -1 || image_y == -1) continue;
+// writes a block's sprites as a render pack or sprite cache record
+void write_rendered_block(FILE* fp, RenderedBlock* block) {
+    static const uint8_t untinted[SIDE_TINT_BYTES] = {0};
+    fwrite(block->pixels_0, 1, SIDE_PIXEL_BYTES, fp);
+    fwrite(block->pixels_1, 1, SIDE_PIXEL_BYTES, fp);
+    fwrite(block->pixels_2, 1, SIDE_PIXEL_BYTES, fp);
+    fwrite(block->pixels_3, 1, SIDE_PIXEL_BYTES, fp);
+    fwrite(block->tints_0 != NULL? block->tints_0 : untinted, 1, SIDE_TINT_BYTES, fp);
+    fwrite(block->tints_1 != NULL? block->tints_1 : untinted, 1, SIDE_TINT_BYTES, fp);
+    fwrite(block->tints_2 != NULL? block->tints_2 : untinted, 1, SIDE_TINT_BYTES, fp);
+    fwrite(block->tints_3 != NULL? block->tints_3 : untinted, 1, SIDE_TINT_BYTES, fp);
+}
 
+/**
+ * Returns the packed sprites for a block's model, pointing into the pack, or NULL when they
+ * have to be rendered.
+ */
+RenderedBlock* find_packed_block(StateModel* model) {
+    if (RENDER_PACK == NULL) {
+        return NULL;
+    }
 
-            // if pixel set by other coordinates skip
-            int i = pixel_index(image_x, image_y, 16);
-            if (image[i] == 0) {
-                printf("x: %d, y: %d\n", image_x, image_y);
+    RenderPackEntry key = {model->signature, 0};
+    RenderPackEntry* entry = bsearch(&key, RENDER_PACK->entries, RENDER_PACK->header->entry_count, sizeof(RenderPackEntry), compare_pack_entries);
+    if (entry == NULL) {
+        return NULL;
+    }
 
-                // otherwise set it
-                int tex_x, tex_y;
-                model_coor_to_texture_x_y(h, y, &tex_x, &tex_y);
-                int t = pixel_index(tex_x, tex_y, 16);
+    return record_rendered_block(RENDER_PACK->data + RENDER_PACK->header->data_offset + entry->offset);
+}
 
-                image[i] = side_texture[t];
-                image[i+1] = side_texture[t+1];
-                image[i+2] = side_texture[t+2];
-                image[i+3] = side_texture[t+3];
+// adds a value to a property's choices unless it's there already
+static void add_choice(char** values, int* count, char* value) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp(values[i], value) == 0) return;
+    }
+    values[(*count)++] = value;
+}
 
-                if (overlay_texture != NULL) {
-                    if (overlay_texture[t+3] > 0) {
-                        image[i] = overlay_texture[t];
-                        image[i+1] = overlay_texture[t+1];
-                        image[i+2] = overlay_texture[t+2];
-                        image[i+3] = overlay_texture[t+3];
-                    }
-                }
+/**
+ * Renders every state of a block that looks different into the pack. The states are found by
+ * trying every combination of the property values its blockstate file checks (plus one value
+ * it doesn't check), since the properties it doesn't mention can't change the model.
+ */
+void pack_block(FILE* fp, const char* name, BlockStateDefinition* definition, FlatMap* packed, RenderPackEntry** entries, uint64_t* entry_count, uint64_t* entries_capacity) {
+    int value_total = 0;
+    for (int c = 0; c < definition->case_count; c++) {
+        for (int w = 0; w < definition->cases[c].when_count; w++) {
+            StateWhen* when = &definition->cases[c].when[w];
+            for (int i = 0; i < when->condition_count; i++) {
+                value_total += when->conditions[i].value_count + 1;
+            }
+        }
+    }
 
-                // apply tint if applicable
-                if (is_grayscale(image[i], image[i+1], image[i+2])) {
-                    image[i] = (image[i] * tint->r) / 255;
-                    image[i+1] = (image[i+1] * tint->g) / 255;
-                    image[i+2] = (image[i+2] * tint->b) / 255;
+    // property -> the values to try, "" stands for any value the file doesn't check
+    char* keys[value_total + 1];
+    char** values[value_total + 1];
+    int value_counts[value_total + 1];
+    int key_count = 0;
+    for (int c = 0; c < definition->case_count; c++) {
+        for (int w = 0; w < definition->cases[c].when_count; w++) {
+            StateWhen* when = &definition->cases[c].when[w];
+            for (int i = 0; i < when->condition_count; i++) {
+                StateCondition* condition = &when->conditions[i];
+                int k = 0;
+                while (k < key_count && strcmp(keys[k], condition->key) != 0) k++;
+                if (k == key_count) {
+                    keys[k] = condition->key;
+                    values[k] = malloc((value_total + 1) * sizeof(char*));
+                    value_counts[k] = 0;
+                    add_choice(values[k], &value_counts[k], "");
+                    key_count++;
+                }
+                for (int v = 0; v < condition->value_count; v++) {
+                    add_choice(values[k], &value_counts[k], condition->values[v]);
                 }
-                // stbi_write_jpg("test.jpg", 16, 16, 4, image, 96);
             }
         }
     }
-}
 
-void combine_images(uint8_t* result, uint8_t* img_1, uint8_t* img_2, uint8_t* img_3, int size) {
-    for (int x = 0; x < size; x++) {
-        for (int y = 0; y < size; y++) {
-            int i = pixel_index(x, y, size);
-            
-            if (img_1[i] != 0) {
-                result[i] = img_1[i];
-                result[i+1] = img_1[i+1];
-                result[i+2] = img_1[i+2];
-                result[i+3] = img_1[i+3];
-            }
+    long combinations = 1;
+    for (int k = 0; k < key_count && combinations <= MAX_PACK_COMBINATIONS; k++) {
+        combinations *= value_counts[k];
+    }
+    if (combinations > MAX_PACK_COMBINATIONS) {
+        printf("%s'%s' has too many states to pack, it'll be rendered live%s\n", YELLOW, name, RESET);
+        combinations = 0;
+    }
 
-            if (img_2[i] != 0) {
-                result[i] = img_2[i];
-                result[i+1] = img_2[i+1];
-                result[i+2] = img_2[i+2];
-                result[i+3] = img_2[i+3];
+    char full_name[256];
+    snprintf(full_name, sizeof(full_name), "minecraft:%s", name);
+    for (long combination = 0; combination < combinations; combination++) {
+        Property properties[key_count + 1];
+        BlockState state = {0};
+        state.name = full_name;
+        state.properties = properties;
+        long rest = combination;
+        for (int k = 0; k < key_count; k++) {
+            char* value = values[k][rest % value_counts[k]];
+            rest /= value_counts[k];
+            if (value[0] != '\0') {
+                properties[state.property_count].key = keys[k];
+                properties[state.property_count].value = value;
+                state.property_count++;
             }
+        }
 
-            if (img_3[i] != 0) {
-                result[i] = img_3[i];
-                result[i+1] = img_3[i+1];
-                result[i+2] = img_3[i+2];
-                result[i+3] = img_3[i+3];
+        StateModel* model = match_state_model(&state);
+        int element_count = 0;
+        for (int p = 0; p < model->part_count; p++) {
+            element_count += model->parts[p]->element_count;
+        }
+        if (element_count > 0 && fm_any_get(packed, &model->signature, sizeof(model->signature)) == NULL) {
+            fm_any_unique(packed, &model->signature, sizeof(model->signature), (void*)1);
+
+            RenderedBlock* block = render_state_model(model, full_name);
+            uint64_t offset = *entry_count * RENDER_PACK_SPRITE_BYTES;
+            write_rendered_block(fp, block);
+            free_rendered_block(block);
+
+            if (*entry_count == *entries_capacity) {
+                *entries_capacity *= 2;
+                *entries = realloc(*entries, *entries_capacity * sizeof(RenderPackEntry));
             }
+            (*entries)[*entry_count].signature = model->signature;
+            (*entries)[*entry_count].offset = offset;
+            (*entry_count)++;
         }
+        free(model->parts);
+        free(model);
+    }
+
+    for (int k = 0; k < key_count; k++) {
+        free(values[k]);
     }
 }
 
+/**
+ * Renders every block of the jar into the cache's render pack (see 'RenderPack'). Returns 0
+ * on success.
+ */
+int build_render_pack(AssetCache* cache) {
+    char path[1024 + 32];
+    char tmp_path[1024 + 32];
+    snprintf(path, sizeof(path), "%s/render.pack", cache->dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/render.pack.tmp", cache->dir);
 
+    FILE* fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        perror("fopen");
+        return 1;
+    }
 
-char* get_file_name_from_minecraft_name(char* jar_folder, char* minecraft_name, char* extension) {
-    int c = 0;
-    char** splits = split(minecraft_name, ":", &c);
-    minecraft_name = splits[1];
-    char* path = CAT(jar_folder, minecraft_name, extension, NULL);
+    RenderPackHeader header = {0};
+    memcpy(header.magic, RENDER_PACK_MAGIC, sizeof(header.magic));
+    header.version = MAPPER_VERSION;
+    header.sprite_bytes = RENDER_PACK_SPRITE_BYTES;
+    header.jar_hash = strtoull(cache->jar_hash, NULL, 16);
+    header.data_offset = RENDER_PACK_ALIGNMENT; // the header is padded out to the first sprite
+    fseek(fp, header.data_offset, SEEK_SET);
+
+    uint64_t entries_capacity = 1024;
+    RenderPackEntry* entries = malloc(entries_capacity * sizeof(RenderPackEntry));
+    FlatMap* packed = new_flat_map_reserved(entries_capacity); // signatures already written
+
+    Element** definitions = map_elements(BLOCK_STATE_DEFINITIONS);
+    for (size_t i = 0; i < BLOCK_STATE_DEFINITIONS->len; i++) {
+        pack_block(fp, definitions[i]->key, definitions[i]->data, packed, &entries, &header.entry_count, &entries_capacity);
+    }
+    free(definitions);
+    free_flat_map(packed);
+
+    // the index goes after the sprites, sorted for binary search
+    qsort(entries, header.entry_count, sizeof(RenderPackEntry), compare_pack_entries);
+    header.index_offset = header.data_offset + header.entry_count * RENDER_PACK_SPRITE_BYTES;
+    fwrite(entries, sizeof(RenderPackEntry), header.entry_count, fp);
+    free(entries);
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    if (fclose(fp) != 0) {
+        perror("fclose");
+        return 1;
+    }
 
-    for (int i = 0; i < c; i++) {
-        free(splits[i]);
+    remove(path);
+    if (rename(tmp_path, path) != 0) {
+        perror("rename");
+        return 1;
     }
-    free(splits);
+    cache->render_pack = 1;
+    save_asset_cache(cache);
 
-    return path;
+    printf("Packed %llu blocks into %s\n", (unsigned long long)header.entry_count, path);
+    return 0;
 }
 
 
-uint8_t* load_texture(char* texture_minecraft_name) {
-    char* path = CAT(TEXTURE_PATH, texture_minecraft_name, ".png", NULL);
-    
-    int width, height, n;
-    uint8_t *data = stbi_load(path, &width, &height, &n, 4);
-    free(path);
+// SPRITE CACHE
 
-    return data;
-}
+/**
+ * Sprites rendered live, kept between runs in 'sprites.cache' in the asset cache directory.
+ *
+ * The file is a header followed by records (a key then every side of the block, laid out like
+ * the render pack's) appended as new blocks are rendered. The key is the block's state model
+ * signature, sprites don't depend on the biome. At startup the file is mapped and indexed, a
+ * torn record at the end from an interrupted run is dropped.
+ */
+#define SPRITE_CACHE_MAGIC "MDMSPRT"
 
-cJSON* load_block_json(const char* block_minecraft_name) {
-    char* path = get_file_name_from_minecraft_name(BLOCKS_PATH, block_minecraft_name, ".json");
-    char* content = read_file(path);
-    cJSON *json = cJSON_Parse(content);
-    free(path);
-    free(content);
-    return json;
-}
+typedef struct {
+    char magic[8];
+    uint32_t version; // MAPPER_VERSION
+    uint32_t sprite_bytes;
+    uint64_t jar_hash;
+} SpriteCacheHeader;
 
-int is_grass_or_tall_grass(char* block_minecraft_name) {
-    return strstr(block_minecraft_name, "grass") != NULL;
-}
+typedef struct {
+    uint64_t key;
+    uint8_t sprites[RENDER_PACK_SPRITE_BYTES];
+} SpriteCacheRecord;
 
-int is_leaves(char* block_minecraft_name) {
-    return strstr(block_minecraft_name, "leaves") != NULL;
-}
+typedef struct {
+    uint8_t* data; // the file as it was at startup
+    size_t size;
+    FlatMap* key_to_record; // read only once opened
 
+    FILE* fp; // new records are appended here
+    FlatMap* appended_keys; // states that look the same are rendered once each, only write the first
+    pthread_mutex_t lock;
+    int loaded;
+    int appended;
+} SpriteCache;
 
-Pixel* get_tint(cJSON* element, char* block_minecraft_name, Map* biome_name_to_biome_data, char* biome_name) {
-    Pixel* tint = malloc(sizeof(Pixel));
-    tint->r = 255;
-    tint->g = 255;
-    tint->b = 255;
-    tint->a = 255;
-    int tint_index = 0;
-    cJSON* faces = cJSON_GetObjectItem(element, "faces");
-    if (faces != NULL) {
-        cJSON* north = cJSON_GetObjectItem(faces, "north");
-        if (cJSON_HasObjectItem(north, "tint_index")) {
-            tint_index = cJSON_GetObjectItem(north, "tintindex")->valueint;
-        }
-        cJSON* south = cJSON_GetObjectItem(faces, "south");
-        if (cJSON_HasObjectItem(south, "tint_index")) {
-            tint_index = cJSON_GetObjectItem(south, "tintindex")->valueint;
-        }
-        cJSON* west = cJSON_GetObjectItem(faces, "west");
-        if (cJSON_HasObjectItem(west, "tint_index")) {
-            tint_index = cJSON_GetObjectItem(west, "tintindex")->valueint;
-        }
-        cJSON* east = cJSON_GetObjectItem(faces, "east");
-        if (cJSON_HasObjectItem(east, "tint_index")) {
-            tint_index = cJSON_GetObjectItem(east, "tintindex")->valueint;
+SpriteCache* SPRITE_CACHE = NULL;
+
+/**
+ * Opens the asset cache's sprite cache, starting a new one if there isn't one or it's for
+ * another jar or version. Returns NULL if it can't be written.
+ */
+SpriteCache* open_sprite_cache(AssetCache* cache) {
+    char path[1024 + 32];
+    snprintf(path, sizeof(path), "%s/sprites.cache", cache->dir);
+
+    SpriteCache* sprites = calloc(1, sizeof(SpriteCache));
+    pthread_mutex_init(&sprites->lock, NULL);
+    sprites->key_to_record = new_flat_map();
+    sprites->appended_keys = new_flat_map();
+
+    SpriteCacheHeader header = {0};
+    memcpy(header.magic, SPRITE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MAPPER_VERSION;
+    header.sprite_bytes = RENDER_PACK_SPRITE_BYTES;
+    header.jar_hash = strtoull(cache->jar_hash, NULL, 16);
+
+    // TRIM a record cut short by a run that was stopped mid append, before the file is mapped
+    size_t valid_size = 0;
+    size_t whole_size = 0;
+    struct stat st;
+    if (stat(path, &st) == 0 && (size_t)st.st_size >= sizeof(SpriteCacheHeader)) {
+        size_t record_count = (st.st_size - sizeof(SpriteCacheHeader)) / sizeof(SpriteCacheRecord);
+        whole_size = sizeof(SpriteCacheHeader) + record_count * sizeof(SpriteCacheRecord);
+        if (whole_size < (size_t)st.st_size && truncate_file(path, whole_size) != 0) {
+            perror("truncate");
+            whole_size = 0; // appending after the cut record would misplace every later one
         }
-        cJSON* up = cJSON_GetObjectItem(faces, "up");
-        if (cJSON_HasObjectItem(up, "tint_index")) {
-            tint_index = cJSON_GetObjectItem(up, "tintindex")->valueint;
+    }
+
+    // INDEX what's there
+    if (whole_size > 0) {
+        size_t size = 0;
+        uint8_t* data = map_file(path, &size);
+        if (data != NULL && size == whole_size && memcmp(data, &header, sizeof(header)) == 0) {
+            sprites->data = data;
+            sprites->size = size;
+            size_t record_count = (size - sizeof(SpriteCacheHeader)) / sizeof(SpriteCacheRecord);
+            fm_reserve(sprites->key_to_record, record_count);
+            for (size_t i = 0; i < record_count; i++) {
+                SpriteCacheRecord* record = (SpriteCacheRecord*)(data + sizeof(SpriteCacheHeader)) + i;
+                if (fm_any_get(sprites->key_to_record, &record->key, sizeof(record->key)) == NULL) {
+                    fm_any_unique(sprites->key_to_record, &record->key, sizeof(record->key), record);
+                }
+            }
+            sprites->loaded = (int)record_count;
+            valid_size = size;
         }
-        cJSON* down = cJSON_GetObjectItem(faces, "down");
-        if (cJSON_HasObjectItem(down, "tint_index")) {
-            tint_index = cJSON_GetObjectItem(down, "tintindex")->valueint;
+        else if (data != NULL) {
+            printf("%sSprite cache '%s' doesn't match the jar, starting over%s\n", YELLOW, path, RESET);
+            unmap_file(data, size);
         }
     }
 
-    Biome* biome = m_get(biome_name_to_biome_data, biome_name);
-    int x = (int)(biome->temperature * 255);
-    int y = (int)(biome->downfall * 255);
-
-    if (is_grass_or_tall_grass(block_minecraft_name)) {
-        // color = get_pixel(grass_png, x, y);
-        char* path = CAT(TEXTURE_PATH, "colormap/", "grass.png", NULL);
-        int width, height, n;
-        uint8_t *data = stbi_load(path, &width, &height, &n, 4);
-        // stbi_write_jpg("test.jpg", width, height, 4, data, 96);
-        int index = x * 4 + y * width * 4;
-        tint->r = data[index];
-        tint->g = data[index+1];
-        tint->b = data[index+2];
-        tint->a = data[index+3];
-        free(path);
-        free(data);
+    // APPEND after the last whole record
+    if (valid_size > 0) {
+        sprites->fp = fopen(path, "ab");
     }
-    else if (is_leaves(block_minecraft_name)) {
-        char* path = CAT(TEXTURE_PATH, "colormap/", "foliage.png", NULL);
-        int width, height, n;
-        uint8_t *data = stbi_load(path, &width, &height, &n, 4);
-        int index = x + y * height;
-        tint->r = data[index];
-        tint->g = data[index+1];
-        tint->b = data[index+2];
-        tint->a = data[index+3];
-        free(path);
-        free(data);
+    else {
+        sprites->fp = fopen(path, "wb");
+        if (sprites->fp != NULL) {
+            fwrite(&header, sizeof(header), 1, sprites->fp);
+        }
     }
-    else if (biome->downfall == 0){
-        char* path = CAT(TEXTURE_PATH, "colormap/", "dry_foliage.png", NULL);
-        int width, height, n;
-        uint8_t *data = stbi_load(path, &width, &height, &n, 4);
-        int index = x + y * height;
-        tint->r = data[index];
-        tint->g = data[index+1];
-        tint->b = data[index+2];
-        tint->a = data[index+3];
-        free(path);
-        free(data);
+    if (sprites->fp == NULL) {
+        perror("fopen");
+        free_flat_map(sprites->key_to_record);
+        free_flat_map(sprites->appended_keys);
+        if (sprites->data != NULL) unmap_file(sprites->data, sprites->size);
+        free(sprites);
+        return NULL;
     }
-        
 
-    return tint;
+    return sprites;
 }
 
 /**
- * Returns pixels (16x16) for a block. 
- * 
- * Blank pixels are set as -1.
- * 
- * The block_minecraft_name should be provided like 'minecraft:block/stairs'
+ * Returns cached sprites pointing into the sprite cache, or NULL when they have to be rendered.
  */
-RenderedBlock* get_rendered_block(char* block_minecraft_name, char* biome_name, Map* rendered_blocks, Map* biome_name_to_biome_data) {
+RenderedBlock* find_cached_sprites(uint64_t key) {
+    if (SPRITE_CACHE == NULL) {
+        return NULL;
+    }
 
-    char* block_name_with_biome = CAT(block_minecraft_name, " ", biome_name, NULL);
-    RenderedBlock* block = m_get(rendered_blocks, block_name_with_biome);
-    
-    // render block if not rendered yet
-    if (block == NULL) {
+    SpriteCacheRecord* record = fm_any_get(SPRITE_CACHE->key_to_record, &key, sizeof(key));
+    if (record == NULL) {
+        return NULL;
+    }
 
-        block == malloc(sizeof(RenderedBlock));
-
-        // RENDER BLOCK SHAPE
-        cJSON *json = load_block_json(block_minecraft_name);
-
-        // GET TEXTURES
-        uint8_t* top_texture = NULL; // 16x16x4
-        uint8_t* side_texture = NULL; // 16x16x4
-        uint8_t* overlay_texture = NULL; // 16x16x4
-        if (cJSON_HasObjectItem(json, "textures")) {
-            cJSON* textures = cJSON_GetObjectItem(json, "textures");
-            if (cJSON_HasObjectItem(textures, "all")) {
-                cJSON* all = cJSON_GetObjectItem(textures, "all");
-                top_texture = load_texture(all->valuestring);
-                side_texture = top_texture;
-            }
-            else if (cJSON_HasObjectItem(textures, "wall")) {
-                cJSON* wall = cJSON_GetObjectItem(textures, "wall");
-                top_texture = load_texture(wall->valuestring);
-                side_texture = top_texture;
-            }
-            else {
-                cJSON* top = cJSON_GetObjectItem(textures, "top");
-                cJSON* side = cJSON_GetObjectItem(textures, "top");
-                top_texture = load_texture(top->valuestring);
-                side_texture = load_texture(side->valuestring);
+    return record_rendered_block(record->sprites);
+}
+
+void append_cached_sprites(uint64_t key, RenderedBlock* block) {
+    if (SPRITE_CACHE == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&SPRITE_CACHE->lock);
+    if (fm_any_get(SPRITE_CACHE->appended_keys, &key, sizeof(key)) != NULL) {
+        pthread_mutex_unlock(&SPRITE_CACHE->lock);
+        return;
+    }
+    fm_any_unique(SPRITE_CACHE->appended_keys, &key, sizeof(key), (void*)1);
+    fwrite(&key, sizeof(key), 1, SPRITE_CACHE->fp);
+    write_rendered_block(SPRITE_CACHE->fp, block);
+    SPRITE_CACHE->appended++;
+    pthread_mutex_unlock(&SPRITE_CACHE->lock);
+}
+
+// writes out anything still buffered, the mapped records stay usable
+void close_sprite_cache(SpriteCache* sprites) {
+    if (fclose(sprites->fp) != 0) {
+        perror("fclose");
+    }
+    sprites->fp = NULL;
+}
+
+
+// SPRITE LODS
+
+/**
+ * Smaller copies of each side of a sprite for the zoomed out levels of the map, so those can be
+ * drawn straight from the world (see 'render_mca') instead of shrinking level 0.
+ *
+ * Level of detail 0 is the 16x16 sprite itself, each one after is half as wide: 8x8, 4x4, 2x2
+ * then 1x1, stored one after another. A pixel is drawn when at least half of the four it comes
+ * from are, with their average color, and takes the tint class most of them have.
+ *
+ * A level drawn from these only approximates level 0 shrunk the same way. Each block is placed at
+ * the pixel its corner falls in and covers the ones drawn before it, so edges can move by a pixel
+ * and a block's colors aren't mixed with its neighbours'.
+ */
+#define LOD_COUNT 5
+#define LOD_SIZE(lod) (16 >> (lod))
+#define LOD_PIXELS (8*8 + 4*4 + 2*2 + 1*1)
+
+const int LOD_OFFSETS[LOD_COUNT] = {0, 0, 8*8, 8*8 + 4*4, 8*8 + 4*4 + 2*2}; // in pixels, level 0 isn't in the lods
+
+// one level of detail from the one before, 'size' is the width of 'src'
+static void halve_sprite(const uint8_t* src, const uint8_t* src_tints, int size, uint8_t* dst, uint8_t* dst_tints) {
+    int half = size / 2;
+    for (int y = 0; y < half; y++) {
+        for (int x = 0; x < half; x++) {
+            int drawn = 0;
+            int sums[4] = {0};
+            int class_counts[TINT_CLASS_COUNT] = {0};
+            for (int s = 0; s < 4; s++) {
+                int p = (2*y + s / 2) * size + 2*x + s % 2;
+                if (src[p*4 + 3] == 0) continue;
+                drawn++;
+                for (int c = 0; c < 4; c++) sums[c] += src[p*4 + c];
+                if (src_tints != NULL) class_counts[src_tints[p]]++;
             }
 
-            // get top, side, and bottom textures
-            if (cJSON_HasObjectItem(textures, "side")) {
-                cJSON* side = cJSON_GetObjectItem(textures, "side");
-                side_texture = load_texture(side->valuestring);
+            int d = y * half + x;
+            if (drawn < 2) {
+                memset(dst + d*4, 0, 4);
+                if (dst_tints != NULL) dst_tints[d] = TINT_NONE;
+                continue;
             }
-            if (cJSON_HasObjectItem(textures, "overlay")) {
-                cJSON* overlay = cJSON_GetObjectItem(textures, "overlay");
-                overlay_texture = load_texture(overlay->valuestring);
+            for (int c = 0; c < 4; c++) dst[d*4 + c] = sums[c] / drawn;
+
+            if (dst_tints != NULL) {
+                int best = TINT_NONE;
+                for (int c = TINT_NONE + 1; c < TINT_CLASS_COUNT; c++) {
+                    if (class_counts[c] > class_counts[best]) best = c;
+                }
+                dst_tints[d] = class_counts[best] * 2 >= drawn? best : TINT_NONE;
             }
         }
+    }
+}
 
+static void build_sprite_lods(uint8_t* pixels, uint8_t* tints, uint8_t** lods, uint8_t** lod_tints) {
+    *lods = malloc(LOD_PIXELS * 4);
+    *lod_tints = tints != NULL? malloc(LOD_PIXELS) : NULL;
+
+    uint8_t* src = pixels;
+    uint8_t* src_tints = tints;
+    for (int lod = 1; lod < LOD_COUNT; lod++) {
+        uint8_t* dst = *lods + LOD_OFFSETS[lod] * 4;
+        uint8_t* dst_tints = tints != NULL? *lod_tints + LOD_OFFSETS[lod] : NULL;
+        halve_sprite(src, src_tints, LOD_SIZE(lod - 1), dst, dst_tints);
+        src = dst;
+        src_tints = dst_tints;
+    }
+}
 
-        // GET OBJECT DIMENSIONS
-        cJSON *model_json = json;
-        cJSON* elements = cJSON_GetObjectItem(model_json, "elements");
-        while (!elements || !cJSON_IsArray(elements)) {
-            if (cJSON_HasObjectItem(model_json, "parent")) {
-                char* parent = cJSON_GetObjectItem(model_json, "parent")->valuestring;
-                cJSON *model_json = load_block_json(parent);
-                elements = cJSON_GetObjectItem(model_json, "elements");
-            }
-            else {
-                break;
-            }
-        }
+// fills in the lods of every side of a block
+void build_rendered_block_lods(RenderedBlock* block) {
+    build_sprite_lods(block->pixels_0, block->tints_0, &block->lods_0, &block->lod_tints_0);
+    build_sprite_lods(block->pixels_1, block->tints_1, &block->lods_1, &block->lod_tints_1);
+    build_sprite_lods(block->pixels_2, block->tints_2, &block->lods_2, &block->lod_tints_2);
+    build_sprite_lods(block->pixels_3, block->tints_3, &block->lods_3, &block->lod_tints_3);
+}
 
-        block = malloc(sizeof(RenderedBlock));
-        block->pixels_0 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
-        block->pixels_1 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
-        block->pixels_2 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
-        block->pixels_3 = (uint8_t *)calloc(16*16*4, sizeof(uint8_t));
 
-        int squares[4][3];
-        // RENDER each orientation
-        if (elements) {
-            int num_elements = cJSON_GetArraySize(elements);
-            for (int side = 0; side < 4; side++) {
-                // side = 3;
+/**
+ * Returns the pixels for a block state id (see 'get_rendered_block'), from the render pack or
+ * the sprite cache when they have them. 'context' points at an int, when it's set the lods are
+ * built too.
+ */
+void* render_block(uint64_t block_state, void* context) {
+    int with_lods = *(int*)context;
 
-                uint8_t* pixels;
-                if (side == 0) 
-                    pixels = block->pixels_0;
-                else if (side == 1)
-                    pixels = block->pixels_1;
-                else if (side == 2)
-                    pixels = block->pixels_2;
-                else if (side == 3)
-                    pixels = block->pixels_3;
+    char* block_minecraft_name = get_block_state((uint32_t)block_state)->name;
+    StateModel* model = get_state_model((uint32_t)block_state);
 
-                for (int i = 0; i < num_elements; i++) {
-                    cJSON* element = cJSON_GetArrayItem(elements, i);
+    RenderedBlock* block = find_packed_block(model);
+    if (block == NULL) {
+        block = find_cached_sprites(model->signature);
+    }
+    if (block == NULL) {
+        block = render_state_model(model, block_minecraft_name);
+        append_cached_sprites(model->signature, block);
+    }
 
-                    // DETERMINE the 3 squares facing the viewer
-                    cJSON* from = cJSON_GetObjectItem(element, "from");
-                    cJSON* to = cJSON_GetObjectItem(element, "to");
+    if (with_lods) {
+        build_rendered_block_lods(block);
+    }
+    return block;
+}
 
+/**
+ * Returns pixels (16x16) for a block state (see 'block_state_id'). The same sprites serve every
+ * biome, tinted pixels are colored when they're blitted (see 'blit_block').
+ * 
+ * Rendered blocks are cached in 'rendered_blocks' keyed on the id. Safe to call from several
+ * threads, each block is only rendered once. The lods are only built when 'with_lods' is set,
+ * which must be the same for every call on a map.
+ */
+RenderedBlock* get_rendered_block(uint32_t block_state, ConcurrentMap* rendered_blocks, int with_lods) {
+    return cm_get_or_create(rendered_blocks, block_state, render_block, &with_lods);
+}
 
-                    // TINT INDEX if applicable
-                    Pixel* tint = get_tint(element, block_minecraft_name, biome_name_to_biome_data, biome_name);
-                    
+/**
+ * Where a block's sprite goes on the canvas. The projection is linear, so callers placing many
+ * blocks project one corner and step from there (see 'render_mca').
+ */
+void block_x_y_z_to_render_x_y_z(int x, int y, int z, int* image_x, int* image_y) {
+    ANGLE_SPECS[ANGLE].block_to_render(x, y, z, image_x, image_y);
+}
 
-                    // top square
-                    uint8_t top_pixels[16*16*4] = {0};
-                    set_top_square(top_pixels, side, top_texture, from, to, tint);
-                    stbi_write_jpg("test.jpg", 16, 16, 4, top_pixels, 96);
+// CANVAS
 
+/**
+ * One zoom level of the map image, split into IMAGE_SIZE x IMAGE_SIZE tiles which are created as
+ * blocks are drawn on them.
+ *
+ * Tiles are written to '<out_dir>/level_<level>/<x>_<y>.png' by 'flush_canvas', x and y being the
+ * tile's top left in level 0 pixels like 'index.html' expects. A tile that's drawn on again after
+ * being flushed is read back from disk first.
+ */
+typedef struct {
+    FlatMap* tiles; // TileCoord -> IMAGE_SIZE*IMAGE_SIZE*4 pixels
+    char* out_dir;
+    int level;
+    int shift; // a pixel is 1 << shift level 0 pixels across, see 'level_shift'
+} Canvas;
+
+#define MAX_LEVELS 4 // the levels 'index.html' has
+#define MAX_OPEN_TILES 64 // zoomed out tiles span many regions, so they're kept until there are this many
+
+// levels 1, 2 and 3 are 4, 16 and 256 times smaller than level 0 across, as in 'index.html'
+int level_shift(int level) {
+    return level == 0? 0 : 1 << level;
+}
 
-                    // left square
-                    uint8_t left_pixels[16*16*4] = {0};
-                    set_left_square(left_pixels, side, side_texture, overlay_texture, from, to, tint);
-                    stbi_write_jpg("test.jpg", 16, 16, 4, left_pixels, 96);
-                    
+typedef struct {
+    int x;
+    int y;
+} TileCoord;
 
-                    // right square
-                    uint8_t right_pixels[16*16*4] = {0};
-                    set_right_square(right_pixels, side, side_texture, overlay_texture, from, to, tint);
-                    stbi_write_jpg("test.jpg", 16, 16, 4, right_pixels, 96);
+Canvas* new_canvas(char* out_dir, int level) {
+    Canvas* canvas = malloc(sizeof(Canvas));
+    canvas->tiles = new_flat_map();
+    canvas->out_dir = out_dir;
+    canvas->level = level;
+    canvas->shift = level_shift(level);
 
-                    combine_images(pixels, top_pixels, left_pixels, right_pixels, 16);
-                    stbi_write_jpg("test.jpg", 16, 16, 4, pixels, 96);
+    char level_dir[1024];
+    snprintf(level_dir, sizeof(level_dir), "%s/level_%d/", out_dir, level);
+    make_dirs(level_dir);
 
-                }
-            }
-        }
-        else {
-            printf("%sCouldn't find block model for '%s' so we'll just use the default block for that one.%s\n", YELLOW, block_minecraft_name, RESET);
-            // XXX: actually do that here
-        }
-        cJSON_free(json);
+    return canvas;
+}
 
+static void tile_path(Canvas* canvas, TileCoord coord, char* path, size_t path_size) {
+    long long units = (long long)IMAGE_SIZE << canvas->shift;
+    snprintf(path, path_size, "%s/level_%d/%lld_%lld.png", canvas->out_dir, canvas->level, coord.x * units, coord.y * units);
+}
 
-        m_put(rendered_blocks, block_name_with_biome, block, sizeof(RenderedBlock));
+// 'value' divided by 2^shift rounded down, like 'tile_of'
+static inline int floor_shift(int value, int shift) {
+    return (value >= 0)? value >> shift : -((-value + (1 << shift) - 1) >> shift);
+}
 
+// floor division, so pixels left of/above 0 land in tile -1
+static int tile_of(int pixel) {
+    return (pixel >= 0)? pixel / IMAGE_SIZE : -((-pixel + IMAGE_SIZE - 1) / IMAGE_SIZE);
+}
 
-    }
+uint8_t* get_tile(Canvas* canvas, int tile_x, int tile_y) {
+    TileCoord coord = {tile_x, tile_y};
+    uint8_t* tile = fm_any_get(canvas->tiles, &coord, sizeof(coord));
+    if (tile == NULL) {
+        tile = calloc(IMAGE_SIZE * IMAGE_SIZE * 4, sizeof(uint8_t));
 
+        // continue a tile flushed by an earlier region
+        char path[1024];
+        tile_path(canvas, coord, path, sizeof(path));
+        int width, height, n;
+        uint8_t* existing = stbi_load(path, &width, &height, &n, 4);
+        if (existing) {
+            if (width == IMAGE_SIZE && height == IMAGE_SIZE) {
+                memcpy(tile, existing, IMAGE_SIZE * IMAGE_SIZE * 4);
+            }
+            stbi_image_free(existing);
+        }
 
-    return block;
+        fm_any_unique(canvas->tiles, &coord, sizeof(coord), tile);
+    }
+    return tile;
 }
 
-void block_x_y_z_to_render_x_y_z(int x, int y, int z, int* image_x, int* image_y) {
-
-    if (strcmp(ANGLE, "NE") == 0) {
-        *image_x = round(-8*x + 8*z);
-        *image_y = round(4*x +4*z + -8*y);
+/**
+ * Draws a size x size block image (16x16 or a smaller level of detail) onto the canvas with its
+ * top left corner at image_x, image_y. Transparent pixels are skipped so blocks drawn earlier
+ * show through. Pixels with a tint class in 'tints' (may be NULL) take that color from
+ * 'biome_tints' (a biome's 'tints').
+ */
+void blit_block(Canvas* canvas, uint8_t* pixels, uint8_t* tints, Pixel* biome_tints, int size, int image_x, int image_y) {
+    uint8_t tinted[16*16*4];
+    if (tints != NULL) {
+        memcpy(tinted, pixels, size * size * 4);
+        tint_pixels(tinted, tints, biome_tints, size * size);
+        pixels = tinted;
     }
-    else if (strcmp(ANGLE, "SE") == 0) {
-        *image_x = round(8*x + 8*z);
-        *image_y = round(4*x + -4*z + -8*y);
+
+    for (int y = 0; y < size; y++) {
+        int canvas_y = image_y + y;
+        int tile_y = tile_of(canvas_y);
+        int in_tile_y = canvas_y - tile_y * IMAGE_SIZE;
+
+        uint8_t* tile = NULL;
+        int tile_x = 0;
+        for (int x = 0; x < size; x++) {
+            int p = pixel_index(x, y, size);
+            if (pixels[p+3] == 0) continue;
+
+            int canvas_x = image_x + x;
+            if (tile == NULL || tile_of(canvas_x) != tile_x) {
+                tile_x = tile_of(canvas_x);
+                tile = get_tile(canvas, tile_x, tile_y);
+            }
+
+            int t = pixel_index(canvas_x - tile_x * IMAGE_SIZE, in_tile_y, IMAGE_SIZE);
+            memcpy(tile + t, pixels + p, 4);
+        }
     }
-    else if (strcmp(ANGLE, "SW") == 0) {
-        *image_x = round(8*x + -8*z);
-        *image_y = round(-4*x + -4*z + -8*y);
+}
+
+/**
+ * Writes every tile to disk and frees them.
+ */
+void flush_canvas(Canvas* canvas) {
+    Element* tiles = flat_map_elements(canvas->tiles);
+    for (size_t i = 0; i < canvas->tiles->len; i++) {
+        TileCoord coord = *(TileCoord*) tiles[i].key;
+        uint8_t* tile = tiles[i].data;
+
+        char path[1024];
+        tile_path(canvas, coord, path, sizeof(path));
+        if (!stbi_write_png(path, IMAGE_SIZE, IMAGE_SIZE, 4, tile, IMAGE_SIZE * 4)) {
+            printf("%sFailed to write tile '%s'%s\n", RED, path, RESET);
+        }
+        free(tile);
     }
-    else if (strcmp(ANGLE, "NW") == 0) {
-        *image_x = round(-8*x + -8*z);
-        *image_y = round(-4*x + 4*z + -8*y);
+    free(tiles);
+    free_flat_map(canvas->tiles);
+    canvas->tiles = new_flat_map();
+}
+
+/**
+ * The pixels and tint classes (may be NULL) of the side of a rendered block facing the viewer for
+ * the current ANGLE, at a level of detail (see 'LOD_COUNT', 0 is the full 16x16 sprite).
+ */
+void rendered_block_lod(RenderedBlock* block, int lod, uint8_t** pixels, uint8_t** tints) {
+    uint8_t* lods;
+    uint8_t* lod_tints;
+    switch (ANGLE) {
+        case ANGLE_NW:
+            *pixels = block->pixels_1;
+            *tints = block->tints_1;
+            lods = block->lods_1;
+            lod_tints = block->lod_tints_1;
+            break;
+        case ANGLE_NE:
+            *pixels = block->pixels_2;
+            *tints = block->tints_2;
+            lods = block->lods_2;
+            lod_tints = block->lod_tints_2;
+            break;
+        case ANGLE_SE:
+            *pixels = block->pixels_3;
+            *tints = block->tints_3;
+            lods = block->lods_3;
+            lod_tints = block->lod_tints_3;
+            break;
+        default:
+            *pixels = block->pixels_0;
+            *tints = block->tints_0;
+            lods = block->lods_0;
+            lod_tints = block->lod_tints_0;
+            break;
     }
-    else {
-        printf("'%s' isn't a valid angle.\n", ANGLE);
-        exit(-1);
+
+    if (lod > 0) {
+        *pixels = lods + LOD_OFFSETS[lod] * 4;
+        *tints = lod_tints != NULL? lod_tints + LOD_OFFSETS[lod] : NULL;
     }
 }
 
 
+
+// SURFACE
+
+#define SURFACE_DEPTH 4 // most blocks recorded per column
+
 typedef struct {
-    int x;
-    int z;
-} Coord;
-int compare_coords(const void *a, const void *b) {
-    const Coord* first = (Coord*)a;
-    const Coord* second = (Coord*)b;
+    uint32_t block_state; // see 'block_state_id'
+    int16_t height; // world y of the block
+    uint16_t biome; // see 'biome_id'
+} SurfaceBlock;
 
-    if (strcmp(ANGLE, "NE") == 0) { // + +
-        long long max_x = MAX(first->x, second->x);
-        long long max_z = MAX(first->z, second->z);
-        long long max_coor = MAX(max_x, max_z);
+/**
+ * The visible blocks of one x z column of a chunk, from the top visible block down to the first
+ * opaque one, so see-through blocks (water, glass, leaves, slabs...) can be drawn over what's under them.
+ *
+ * Runs of the same see-through block (like deep water) are recorded once. At most SURFACE_DEPTH
+ * blocks are kept, deeper blocks are treated as hidden.
+ */
+typedef struct {
+    SurfaceBlock blocks[SURFACE_DEPTH]; // top first
+    uint8_t depth; // number of blocks recorded for the column, 0 if the column is empty
+    uint8_t closed; // reached an opaque block (or SURFACE_DEPTH blocks), nothing below is visible
+} SurfaceColumn;
 
-        long long dist_first = llabs(max_coor - first->x) + llabs(max_coor - first->z);
-        long long dist_second = llabs(max_coor - second->x) + llabs(max_coor - second->z);
-        return dist_second - dist_first;
+/**
+ * Records the next block down a column. Returns 1 if this closed the column.
+ */
+static int push_surface_block(SurfaceColumn* column, uint32_t block_state, int height, uint16_t biome, int opaque) {
+    if (column->depth > 0 && column->blocks[column->depth - 1].block_state == block_state) {
+        // same see-through block as above it, nothing new to draw
+        return 0;
     }
-    else if (strcmp(ANGLE, "SE") == 0) {  // + -
-        long long max_x = MAX(first->x, second->x);
-        long long min_z = MIN(first->z, second->z);
-        long long max_coor = MAX(llabs(max_x), llabs(min_z));
 
-        long long dist_first = llabs(max_coor - first->x) + llabs(-max_coor - first->z);
-        long long dist_second = llabs(max_coor - second->x) + llabs(-max_coor - second->z);
-        return dist_second - dist_first;
-    }
-    else if (strcmp(ANGLE, "SW") == 0) {  // - -
-        long long min_x = MIN(first->x, second->x);
-        long long min_z = MIN(first->z, second->z);
-        long long min_coor = MIN(min_x, min_z);
+    SurfaceBlock* block = &column->blocks[column->depth++];
+    block->block_state = block_state;
+    block->height = height;
+    block->biome = biome;
+
+    column->closed = opaque || column->depth == SURFACE_DEPTH;
+    return column->closed;
+}
+
+#define SURFACE_COLUMNS (SECTION_SIZE*SECTION_SIZE)
+
+// index of a column in a chunk's surface (x and z are 0-15 within the chunk)
+static inline int surface_index(int x, int z) {
+    return z * SECTION_SIZE + x;
+}
 
-        long long dist_first = llabs(min_coor - first->x) + llabs(min_coor - first->z);
-        long long dist_second = llabs(min_coor - second->x) + llabs(min_coor - second->z);
-        return dist_second - dist_first;
+// one bit per section palette entry, a palette never has more entries than the section has blocks
+typedef uint64_t PaletteBits[BLOCKS_PER_SECTION / 64];
+#define PALETTE_BIT_SET(bits, i) ((bits)[(i) >> 6] |= 1ULL << ((i) & 63))
+#define PALETTE_BIT_TEST(bits, i) (((bits)[(i) >> 6] >> ((i) & 63)) & 1)
 
+// sorts sections from the top of the world down
+int compare_sections_top_down(const void *a, const void *b) {
+    int first = nbt_tag_compound_get(*(nbt_tag_t**)a, "Y")->tag_byte.value;
+    int second = nbt_tag_compound_get(*(nbt_tag_t**)b, "Y")->tag_byte.value;
+    return second - first;
+}
+
+#define BIOMES_PER_SECTION 64 // 4x4x4 cells of 4x4x4 blocks
+
+/**
+ * Decodes a section's biomes into biome ids (see 'biome_id') for each of its 4x4x4 cells, indexed 
+ * by 'biome_cell_index'.
+ */
+void decode_section_biomes(nbt_tag_t *biomes, uint16_t out[BIOMES_PER_SECTION]) {
+    nbt_tag_t *biomes_palette = nbt_tag_compound_get(biomes, "palette");
+    nbt_tag_t *biomes_data = nbt_tag_compound_get(biomes, "data");
+
+    size_t palette_size = biomes_palette->tag_list.size;
+    uint16_t palette_ids[palette_size];
+    for (size_t p = 0; p < palette_size; p++) {
+        palette_ids[p] = biome_id(nbt_tag_list_get(biomes_palette, p)->tag_string.value);
     }
-    else if (strcmp(ANGLE, "NW") == 0) {  // - +
-        long long min_x = MIN(first->x, second->x);
-        long long max_z = MAX(first->z, second->z);
-        long long max_coor = MAX(llabs(min_x), llabs(max_z));
 
-        long long dist_first = llabs(-max_coor - first->x) + llabs(max_coor - first->z);
-        long long dist_second = llabs(-max_coor - second->x) + llabs(max_coor - second->z);
-        return dist_second - dist_first;
+    if (palette_size == 1 || !biomes_data) {
+        for (int i = 0; i < BIOMES_PER_SECTION; i++) out[i] = palette_ids[0];
+        return;
     }
-    else {
-        printf("'%s' isn't a valid angle.\n", ANGLE);
-        exit(-1);
+
+    uint16_t indices[BIOMES_PER_SECTION];
+    unpack_palette_indices(biomes_data->tag_long_array.value, biomes_data->tag_long_array.size, palette_bits(palette_size), BIOMES_PER_SECTION, indices);
+    for (int i = 0; i < BIOMES_PER_SECTION; i++) {
+        out[i] = palette_ids[indices[i] < palette_size ? indices[i] : 0];
     }
 }
 
-void render_mca(const char *region_file_path, Map* block_tag_to_rendered_blocks, Map* biome_name_to_biome_data) {
+// index into a decoded section biome grid for a block in the section (x, y and z are 0-15)
+static inline int biome_cell_index(int x, int y, int z) {
+    return ((y >> 2) << 4) | ((z >> 2) << 2) | (x >> 2);
+}
+
+/**
+ * Draws the surface of every chunk in a region file onto each canvas, at the canvas' scale with
+ * the matching sprite level of detail, so zoomed out levels cost about as much as finding the
+ * surface.
+ */
+void render_mca(const char *region_file_path, Canvas** canvases, int canvas_count, ConcurrentMap* block_tag_to_rendered_blocks) {
 
     if (mkdir("dump", 0755) == 0) {
         printf("Directory created: %s\n", "dump");
@@ -2104,6 +4725,12 @@ void render_mca(const char *region_file_path, Map* block_tag_to_rendered_blocks,
     long long region_x, region_z;
     extract_mca_region_coordinates(region_file_path, &region_x, &region_z);
 
+    // only zoomed out levels draw from the lods
+    int with_lods = 0;
+    for (int c = 0; c < canvas_count; c++) {
+        with_lods = with_lods || canvases[c]->shift > 0;
+    }
+
     FILE *fp = fopen(region_file_path, "rb");
     if (!fp) { perror("fopen"); return; }
 
@@ -2160,32 +4787,23 @@ void render_mca(const char *region_file_path, Map* block_tag_to_rendered_blocks,
             int chunk_x = xPosTag->tag_int.value * 16;
             int chunk_z = zPosTag->tag_int.value * 16;
 
-            // ITERATE over sections of chunk to find the surface blocks
-            typedef struct {
-                char *block_type;
-                
-                // roations
-                char* axis; // logs/quartz piller
-                char* facing; // stairs and doors direction NESW
-                char* half; // stairs top or bottom
-                char* shape; // stair modifiers
-                char* type; // slab top or bottom
-                char* rotation; // 0-3 rotation for other blocks
-
-                // biome
-                char *biome;
-            } Block;
-            Map* x_z_to_top_blocks = new_map();
-            for (size_t i = 0; i < sections->tag_list.size; ++i) {
-                nbt_tag_t *section = nbt_tag_list_get(sections, i);
+            // ITERATE over sections of chunk from the top down to find the surface blocks
+            SurfaceColumn surface[SURFACE_COLUMNS];
+            memset(surface, 0, sizeof(surface));
+            int open_columns = SURFACE_COLUMNS;
 
-                nbt_tag_t *biomes = nbt_tag_compound_get(section, "biomes");
-                nbt_tag_t *biomes_palette = nbt_tag_compound_get(biomes, "palette");
-                nbt_tag_t *biomes_data = nbt_tag_compound_get(biomes, "data");
+            size_t section_count = sections->tag_list.size;
+            nbt_tag_t *ordered_sections[section_count];
+            for (size_t i = 0; i < section_count; ++i) {
+                ordered_sections[i] = nbt_tag_list_get(sections, i);
+            }
+            qsort(ordered_sections, section_count, sizeof(nbt_tag_t*), compare_sections_top_down);
 
+            for (size_t i = 0; i < section_count && open_columns > 0; ++i) {
+                nbt_tag_t *section = ordered_sections[i];
+
+                nbt_tag_t *biomes = nbt_tag_compound_get(section, "biomes");
                 nbt_tag_t *bs = nbt_tag_compound_get(section, "block_states");
-                nbt_tag_t *palette = nbt_tag_compound_get(bs, "palette");
-                nbt_tag_t *data = nbt_tag_compound_get(bs, "data");
 
                 int section_i = nbt_tag_compound_get(section, "Y")->tag_byte.value;
                 int section_y = section_i * 16;
@@ -2194,133 +4812,60 @@ void render_mca(const char *region_file_path, Map* block_tag_to_rendered_blocks,
                     nbt_tag_t *palette = nbt_tag_compound_get(bs, "palette");
                     nbt_tag_t *data = nbt_tag_compound_get(bs, "data");
 
-                    if (data) {
-                        uint8_t blocks[16][16][16];
-                        decode_block_states(data->tag_long_array.value, data->tag_long_array.size, palette->tag_list.size, blocks);
-
-                        for (size_t y = 0; y < 16; y++) {
-                            for (size_t z = 0; z < 16; z++) {
-                                for (size_t x = 0; x < 16; x++) {
-
-                                    // get block type from palette
-                                    uint8_t idx = blocks[x][y][z];
-                                    nbt_tag_t *block_tag = nbt_tag_list_get(palette, idx);
-                                    nbt_tag_t *name_tag = block_tag ? nbt_tag_compound_get(block_tag, "Name") : NULL;
-                                    const char *type = name_tag ? name_tag->tag_string.value : "unknown";
-                                    if (strcmp(type,  "minecraft:air") != 0) {
-
-                                        // get block coordinates
-                                        int block_x = chunk_x + x;
-                                        int block_y = section_y + y;
-                                        int block_z = chunk_z + z;
-
-                                        // make block
-                                        char tag[256];
-                                        sprintf(tag, "%d %d", block_x, block_z);
-                                        Block* block = malloc(sizeof(Block));
-                                        block->block_type = strdup(type);
-
-                                        // get rotation
-                                        nbt_tag_t *properties = block_tag ? nbt_tag_compound_get(block_tag, "Properties") : NULL;
-                                        if (properties) {
-
-                                            // Example: get 'axis' property (logs, pillars)
-                                            nbt_tag_t *axis_tag = nbt_tag_compound_get(properties, "axis");
-                                            if (axis_tag && axis_tag->type == NBT_TYPE_STRING) {
-                                                const char *axis = axis_tag->tag_string.value;
-                                                block->axis = strdup(axis);
-                                            }
-
-                                            // Example: get 'facing' property
-                                            nbt_tag_t *facing_tag = nbt_tag_compound_get(properties, "facing");
-                                            if (facing_tag && facing_tag->type == NBT_TYPE_STRING) {
-                                                const char *facing = facing_tag->tag_string.value;
-                                                block->facing = strdup(facing);
-                                            }
-
-                                            // Example: get 'half' property
-                                            nbt_tag_t *half_tag = nbt_tag_compound_get(properties, "half");
-                                            if (half_tag && half_tag->type == NBT_TYPE_STRING) {
-                                                const char *half = half_tag->tag_string.value;
-                                                block->half = strdup(half);
-                                            }
-
-                                            // Example: get 'shape' property
-                                            nbt_tag_t *shape_tag = nbt_tag_compound_get(properties, "shape");
-                                            if (shape_tag && shape_tag->type == NBT_TYPE_STRING) {
-                                                const char *shape = shape_tag->tag_string.value;
-                                                block->shape = strdup(shape);
-                                            }
-
-                                            // Example: get 'type' property
-                                            nbt_tag_t *type_tag = nbt_tag_compound_get(properties, "type");
-                                            if (type_tag && type_tag->type == NBT_TYPE_STRING) {
-                                                const char *type = type_tag->tag_string.value;
-                                                block->type = strdup(type);
-                                            }
-
-                                            // Example: get 'rotation' property
-                                            nbt_tag_t *rotation_tag = nbt_tag_compound_get(properties, "rotation");
-                                            if (rotation_tag && rotation_tag->type == NBT_TYPE_STRING) {
-                                                const char *rotation = rotation_tag->tag_string.value;
-                                                block->rotation = strdup(rotation);
-                                            }
-
-                                        }
-
-                                        // get block biome
-                                        if (biomes_palette->tag_list.size == 1 || !biomes_data) {
-                                            nbt_tag_t *biome_entry = nbt_tag_list_get(biomes_palette, 0);
-                                            const char *biome_name = biome_entry->tag_string.value;
-                                            block->biome = biome_name;
-                                        }
-                                        else {
-                                            // Convert block coordinates to biome coordinates (divide by 4)
-                                            int biome_x = x / 4;  // 0-3
-                                            int biome_y = y / 4;  // 0-3 (within the section)
-                                            int biome_z = z / 4;  // 0-3
-                                            
-                                            // Calculate the index in the 4x4x4 biome array
-                                            int biome_index = biome_y * 16 + biome_z * 4 + biome_x;
-                                            
-                                            // Calculate bits per entry (minimum 1 bit)
-                                            int bits_per_entry = 0;
-                                            int temp = biomes_palette->tag_list.size - 1;
-                                            while (temp > 0) {
-                                                bits_per_entry++;
-                                                temp >>= 1;
-                                            }
-                                            if (bits_per_entry == 0) bits_per_entry = 1;
-                                            
-                                            // Get the data array (array of longs)
-                                            const int64_t *data_array = biomes_data->tag_long_array.value;
-                                            
-                                            // Extract the palette index from the packed data
-                                            int values_per_long = 64 / bits_per_entry;
-                                            int long_index = biome_index / values_per_long;
-                                            int offset_in_long = biome_index % values_per_long;
-                                            
-                                            int64_t data_long = data_array[long_index];
-                                            int shift = offset_in_long * bits_per_entry;
-                                            int palette_index = (data_long >> shift) & ((1 << bits_per_entry) - 1);
-                                            
-                                            // Get the biome name from the palette
-                                            nbt_tag_t *biome_entry = nbt_tag_list_get(biomes_palette, palette_index);
-                                            const char *biome_name = biome_entry->tag_string.value;
-                                            block->biome = biome_name;
-                                            
-                                        }
-
-                                        // store in map
-                                        m_put(x_z_to_top_blocks, tag, block, sizeof(Block*));
-                                    }
-                                    // printf("x: %d, y: %d, z: %d;  %s    ", x, y, z, name);
-                                }
-                                // printf("\n");
+                    // resolve the palette to block state ids and air/opaque bits once for the whole section
+                    size_t palette_size = palette->tag_list.size;
+                    if (palette_size == 0 || palette_size > BLOCKS_PER_SECTION) {
+                        printf("%sSection %d in '%s' has a palette of %zu entries, skipping it%s\n", YELLOW, section_i, region_file_path, palette_size, RESET);
+                        continue;
+                    }
+                    uint32_t palette_states[palette_size];
+                    PaletteBits air = {0};
+                    PaletteBits opaque = {0};
+                    int all_air = 1;
+                    for (size_t p = 0; p < palette_size; p++) {
+                        palette_states[p] = block_state_id(nbt_tag_list_get(palette, p));
+                        BlockState* state = get_block_state(palette_states[p]);
+                        if (state->is_air) PALETTE_BIT_SET(air, p);
+                        if (!state->is_transparent) PALETTE_BIT_SET(opaque, p);
+                        all_air = all_air && state->is_air;
+                    }
+
+                    // nothing but air, no need to look at the blocks
+                    if (all_air) continue;
+
+                    uint16_t biome_grid[BIOMES_PER_SECTION];
+                    decode_section_biomes(biomes, biome_grid);
+
+                    // single value section (no 'data'), every block is the palette entry so the
+                    // section's top layer is the next block down every open column
+                    if (!data) {
+                        int is_opaque = PALETTE_BIT_TEST(opaque, 0);
+                        for (size_t z = 0; z < 16; z++) {
+                            for (size_t x = 0; x < 16; x++) {
+                                SurfaceColumn* column = &surface[surface_index(x, z)];
+                                if (column->closed) continue;
+                                open_columns -= push_surface_block(column, palette_states[0], section_y + 15, biome_grid[biome_cell_index(x, 15, z)], is_opaque);
                             }
-                            // printf("\n\n");
                         }
+                        continue;
+                    }
 
+                    uint16_t blocks[16][16][16];
+                    decode_block_states(data->tag_long_array.value, data->tag_long_array.size, palette_size, blocks);
+
+                    for (int y = 15; y >= 0 && open_columns > 0; y--) {
+                        for (size_t z = 0; z < 16; z++) {
+                            for (size_t x = 0; x < 16; x++) {
+                                SurfaceColumn* column = &surface[surface_index(x, z)];
+                                if (column->closed) continue;
+
+                                // get block type from palette
+                                uint16_t idx = blocks[x][y][z];
+                                if (PALETTE_BIT_TEST(air, idx)) continue;
+
+                                open_columns -= push_surface_block(column, palette_states[idx], section_y + y, biome_grid[biome_cell_index(x, y, z)], PALETTE_BIT_TEST(opaque, idx));
+                            }
+                        }
                     }
                 }
 
@@ -2339,24 +4884,47 @@ void render_mca(const char *region_file_path, Map* block_tag_to_rendered_blocks,
                     coordinates[z*16 + x].z = block_z;
                 }
             }
-            qsort(coordinates, s_blocks, sizeof(Coord), compare_coords);
+            qsort(coordinates, s_blocks, sizeof(Coord), ANGLE_SPECS[ANGLE].compare_coords);
+
+            // project the chunk's corner once, every block is a whole number of steps from it
+            int chunk_image_x, chunk_image_y, x_step_x, x_step_y, y_step_x, y_step_y, z_step_x, z_step_y;
+            block_x_y_z_to_render_x_y_z(chunk_x, 0, chunk_z, &chunk_image_x, &chunk_image_y);
+            block_x_y_z_to_render_x_y_z(1, 0, 0, &x_step_x, &x_step_y);
+            block_x_y_z_to_render_x_y_z(0, 1, 0, &y_step_x, &y_step_y);
+            block_x_y_z_to_render_x_y_z(0, 0, 1, &z_step_x, &z_step_y);
+
             for (int i = 0; i < s_blocks; i++) {
                 
                 // get block
                 Coord bl_c = coordinates[i];
-                char tag[256];
-                sprintf(tag, "%d %d", bl_c.x, bl_c.z);
-                Block* block = m_get(x_z_to_top_blocks, tag);
-
-                // get rendered block
-                RenderedBlock* render = get_rendered_block(block->block_type, block->biome, block_tag_to_rendered_blocks, biome_name_to_biome_data);
-                
-                printf("yay\n");
-
-                // determine image coordinates
-
-                // add to image
-                
+                int local_x = bl_c.x - chunk_x;
+                int local_z = bl_c.z - chunk_z;
+                SurfaceColumn* column = &surface[surface_index(local_x, local_z)];
+                int column_image_x = chunk_image_x + local_x * x_step_x + local_z * z_step_x;
+                int column_image_y = chunk_image_y + local_x * x_step_y + local_z * z_step_y;
+
+                // draw the column bottom up so see-through blocks cover what's under them
+                for (int d = column->depth - 1; d >= 0; d--) {
+                    SurfaceBlock* block = &column->blocks[d];
+
+                    // get rendered block
+                    RenderedBlock* render = get_rendered_block(block->block_state, block_tag_to_rendered_blocks, with_lods);
+
+                    // determine image coordinates
+                    int image_x = column_image_x + block->height * y_step_x;
+                    int image_y = column_image_y + block->height * y_step_y;
+
+                    // add to each level's image, blocks smaller than a pixel land on the one their corner is in
+                    Pixel* biome_tints = get_biome(block->biome)->tints;
+                    for (int c = 0; c < canvas_count; c++) {
+                        Canvas* canvas = canvases[c];
+                        int lod = MIN(canvas->shift, LOD_COUNT - 1);
+                        uint8_t* pixels;
+                        uint8_t* tints;
+                        rendered_block_lod(render, lod, &pixels, &tints);
+                        blit_block(canvas, pixels, tints, biome_tints, LOD_SIZE(lod), floor_shift(image_x, canvas->shift), floor_shift(image_y, canvas->shift));
+                    }
+                }
             }
 
             nbt_free_tag(chunk_tag);
@@ -2370,6 +4938,562 @@ void render_mca(const char *region_file_path, Map* block_tag_to_rendered_blocks,
 }
 
 
+// BENCHMARK
+
+double now_seconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define BENCHMARK_KEYS 200000
+#define BENCHMARK_LOOKUP_PASSES 10
+
+static void* benchmark_lookup_thread(void* map) {
+    size_t found = 0;
+    for (int pass = 0; pass < BENCHMARK_LOOKUP_PASSES; pass++) {
+        for (uint64_t i = 0; i < BENCHMARK_KEYS; i++) {
+            found += cm_get(map, (i << 32) | (i * 7)) != NULL;
+        }
+    }
+    return (void*)(uintptr_t)found;
+}
+
+/**
+ * Times lookups on the concurrent map from more and more threads. With reads that don't
+ * serialize, the time per lookup stays about the same.
+ */
+void benchmark_concurrent_map() {
+    ConcurrentMap* map = new_concurrent_map();
+    for (uint64_t i = 0; i < BENCHMARK_KEYS; i++) {
+        cm_put_if_absent(map, (i << 32) | (i * 7), (void*)(uintptr_t)(i + 1));
+    }
+
+    printf("\n%-22s %12s %12s\n", "ConcurrentMap threads", "hit ns", "lookups/s");
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        pthread_t ids[8];
+        size_t found = 0;
+
+        double start = now_seconds();
+        for (int t = 0; t < threads; t++) {
+            pthread_create(&ids[t], NULL, benchmark_lookup_thread, map);
+        }
+        for (int t = 0; t < threads; t++) {
+            void* result;
+            pthread_join(ids[t], &result);
+            found += (uintptr_t)result;
+        }
+        double seconds = now_seconds() - start;
+
+        if (found != (size_t)BENCHMARK_KEYS * BENCHMARK_LOOKUP_PASSES * threads) {
+            printf("%sBenchmark lookups returned the wrong results%s\n", RED, RESET);
+        }
+
+        double lookups = (double)BENCHMARK_KEYS * BENCHMARK_LOOKUP_PASSES * threads;
+        printf("%-22d %12.1f %12.0f\n", threads, seconds * 1e9 * threads / lookups, lookups / seconds);
+    }
+
+    free_concurrent_map(map);
+}
+
+#define BENCHMARK_FILL_KEYS 1000000
+
+/**
+ * Times filling a million entry map by growing it, by reserving first and with a builder.
+ */
+void benchmark_map_fill() {
+    printf("\n%-22s %12s\n", "Fill 1M entries", "ms");
+    for (int mode = 0; mode < 3; mode++) {
+        double start = now_seconds();
+
+        Map* map = NULL;
+        if (mode == 2) {
+            MapBuilder* builder = new_map_builder(0);
+            for (int i = 0; i < BENCHMARK_FILL_KEYS; i++) {
+                mb_int_add(builder, i, (void*)(uintptr_t)(i + 1));
+            }
+            map = mb_build(builder);
+        }
+        else {
+            map = mode == 0? new_map() : new_map_reserved(BENCHMARK_FILL_KEYS);
+            for (int i = 0; i < BENCHMARK_FILL_KEYS; i++) {
+                m_int_unique(map, i, (void*)(uintptr_t)(i + 1));
+            }
+        }
+
+        double seconds = now_seconds() - start;
+        const char* labels[] = {"Map (growing)", "Map (reserved)", "MapBuilder"};
+        printf("%-22s %12.1f\n", labels[mode], seconds * 1e3);
+
+        free_map(map);
+    }
+}
+
+/**
+ * Times inserts, hits and misses on both map types with the two kinds of keys the
+ * mapper uses: 8 byte ids (the rendered block cache) and block state names (the interners).
+ */
+void benchmark_maps() {
+    char** names = malloc(BENCHMARK_KEYS * sizeof(char*));
+    char** missing = malloc(BENCHMARK_KEYS * sizeof(char*));
+    for (int i = 0; i < BENCHMARK_KEYS; i++) {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "minecraft:block_%d[facing=north,half=bottom]", i);
+        names[i] = strdup(buffer);
+        snprintf(buffer, sizeof(buffer), "minecraft:missing_%d", i);
+        missing[i] = strdup(buffer);
+    }
+
+    printf("%-22s %12s %12s %12s %12s\n", "", "insert ns", "hit ns", "miss ns", "bytes");
+    for (int use_strings = 0; use_strings <= 1; use_strings++) {
+        for (int flat = 0; flat <= 1; flat++) {
+            Map* map = new_map();
+            FlatMap* flat_map = new_flat_map();
+            size_t found = 0;
+
+            double start = now_seconds();
+            for (uint64_t i = 0; i < BENCHMARK_KEYS; i++) {
+                uint64_t key = (i << 32) | (i * 7);
+                void* data = (void*)(uintptr_t)(i + 1);
+                if (use_strings) {
+                    if (flat) fm_unique(flat_map, names[i], data);
+                    else m_unique(map, names[i], data);
+                }
+                else {
+                    if (flat) fm_any_unique(flat_map, &key, sizeof(key), data);
+                    else m_any_unique(map, &key, sizeof(key), data);
+                }
+            }
+            double insert = now_seconds() - start;
+
+            start = now_seconds();
+            for (int pass = 0; pass < BENCHMARK_LOOKUP_PASSES; pass++) {
+                for (uint64_t i = 0; i < BENCHMARK_KEYS; i++) {
+                    uint64_t key = (i << 32) | (i * 7);
+                    if (use_strings) found += (flat? fm_get(flat_map, names[i]) : m_get(map, names[i])) != NULL;
+                    else found += (flat? fm_any_get(flat_map, &key, sizeof(key)) : m_any_get(map, &key, sizeof(key))) != NULL;
+                }
+            }
+            double hit = now_seconds() - start;
+
+            start = now_seconds();
+            for (uint64_t i = 0; i < BENCHMARK_KEYS; i++) {
+                uint64_t key = (i << 32) | (i * 7 + 1);
+                if (use_strings) found += (flat? fm_get(flat_map, missing[i]) : m_get(map, missing[i])) != NULL;
+                else found += (flat? fm_any_get(flat_map, &key, sizeof(key)) : m_any_get(map, &key, sizeof(key))) != NULL;
+            }
+            double miss = now_seconds() - start;
+
+            if (found != (size_t)BENCHMARK_KEYS * BENCHMARK_LOOKUP_PASSES) {
+                printf("%sBenchmark lookups returned the wrong results%s\n", RED, RESET);
+            }
+
+            char label[64];
+            snprintf(label, sizeof(label), "%s %s", flat? "FlatMap" : "Map", use_strings? "(state names)" : "(u64 ids)");
+            printf("%-22s %12.1f %12.1f %12.1f %12zu\n", 
+                label,
+                insert * 1e9 / BENCHMARK_KEYS,
+                hit * 1e9 / ((double)BENCHMARK_KEYS * BENCHMARK_LOOKUP_PASSES),
+                miss * 1e9 / BENCHMARK_KEYS,
+                flat? flat_map_bytes(flat_map) : map_bytes(map)
+            );
+
+            free_map(map);
+            free_flat_map(flat_map);
+        }
+    }
+
+    for (int i = 0; i < BENCHMARK_KEYS; i++) {
+        free(names[i]);
+        free(missing[i]);
+    }
+    free(names);
+    free(missing);
+
+    benchmark_concurrent_map();
+    benchmark_map_fill();
+}
+
+
+#define BENCHMARK_SPRITES 4096
+#define BENCHMARK_KERNEL_PASSES 20
+
+// the per pixel tint 'set_top_square' and the others used to apply as they drew, before tint classes
+static void benchmark_tint_per_pixel(uint8_t* image, const Pixel* tint) {
+    for (int i = 0; i < 16*16*4; i += 4) {
+        if (is_grayscale(image[i], image[i+1], image[i+2])) {
+            image[i] = (image[i] * tint->r) / 255;
+            image[i+1] = (image[i+1] * tint->g) / 255;
+            image[i+2] = (image[i+2] * tint->b) / 255;
+        }
+    }
+}
+
+// 'combine_images' before it used 'composite_pixels'
+static void benchmark_combine_per_pixel(uint8_t* result, uint8_t* img_1, uint8_t* img_2, uint8_t* img_3, int size) {
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            int i = pixel_index(x, y, size);
+            if (img_1[i] != 0) memcpy(result + i, img_1 + i, 4);
+            if (img_2[i] != 0) memcpy(result + i, img_2 + i, 4);
+            if (img_3[i] != 0) memcpy(result + i, img_3 + i, 4);
+        }
+    }
+}
+
+/**
+ * Times the sprite tint and composite kernels against the per pixel code they replaced, on
+ * random sprites where about half the pixels are gray (and marked as grass) and half of each
+ * layer is drawn. Also checks all of them give the same bytes.
+ */
+void benchmark_kernels() {
+    size_t bytes = (size_t)BENCHMARK_SPRITES * 16*16*4;
+    uint8_t* source = malloc(bytes);
+    uint8_t* layers = malloc(bytes);
+    uint8_t* classes = malloc(bytes / 4);
+    uint8_t* results[3];
+    for (int k = 0; k < 3; k++) results[k] = malloc(bytes);
+
+    uint32_t random = 12345;
+    for (size_t i = 0; i < bytes; i += 4) {
+        random = random * 1664525 + 1013904223;
+        uint8_t value = random >> 24;
+        int gray = (random >> 8) & 1;
+        source[i] = value;
+        source[i+1] = gray? value : (uint8_t)(random >> 12);
+        source[i+2] = gray? value : (uint8_t)(random >> 4);
+        source[i+3] = 255;
+        classes[i / 4] = gray? TINT_GRASS : TINT_NONE;
+        memcpy(layers + i, source + i, 4);
+        if ((random >> 9) & 1) layers[i] = 0;
+    }
+    Pixel tint = {145, 189, 89, 255};
+    Pixel tints[TINT_CLASS_COUNT];
+    for (int c = 0; c < TINT_CLASS_COUNT; c++) tints[c] = WHITE;
+    tints[TINT_GRASS] = tint;
+
+    printf("\n%-22s %12s %12s   (%s kernels)\n", "Sprite kernels", "tint ns", "combine ns", SIMD_KERNELS);
+    const char* labels[] = {"per pixel", "scalar", SIMD_KERNELS};
+    double sprites = (double)BENCHMARK_SPRITES * BENCHMARK_KERNEL_PASSES;
+    for (int k = 0; k < 3; k++) {
+        uint8_t* result = results[k];
+
+        double tint_seconds = 0;
+        for (int pass = 0; pass < BENCHMARK_KERNEL_PASSES; pass++) {
+            memcpy(result, source, bytes);
+            double start = now_seconds();
+            for (int s = 0; s < BENCHMARK_SPRITES; s++) {
+                uint8_t* sprite = result + (size_t)s * 16*16*4;
+                uint8_t* sprite_classes = classes + (size_t)s * 16*16;
+                if (k == 0) benchmark_tint_per_pixel(sprite, &tint);
+                else if (k == 1) tint_pixels_scalar(sprite, sprite_classes, tints, 16*16);
+                else tint_pixels(sprite, sprite_classes, tints, 16*16);
+            }
+            tint_seconds += now_seconds() - start;
+        }
+
+        // the tinted sprites are drawn over by three layers taken from neighbouring sprites
+        double start = now_seconds();
+        for (int pass = 0; pass < BENCHMARK_KERNEL_PASSES; pass++) {
+            for (int s = 0; s + 3 <= BENCHMARK_SPRITES; s++) {
+                uint8_t* sprite = result + (size_t)s * 16*16*4;
+                uint8_t* layer = layers + (size_t)s * 16*16*4;
+                if (k == 0) {
+                    benchmark_combine_per_pixel(sprite, layer, layer + 16*16*4, layer + 2*16*16*4, 16);
+                }
+                else {
+                    for (int l = 0; l < 3; l++) {
+                        if (k == 1) composite_pixels_scalar(sprite, layer + l*16*16*4, 16*16);
+                        else composite_pixels(sprite, layer + l*16*16*4, 16*16);
+                    }
+                }
+            }
+        }
+        double combine_seconds = now_seconds() - start;
+
+        printf("%-22s %12.1f %12.1f\n", labels[k], tint_seconds * 1e9 / sprites, combine_seconds * 1e9 / sprites);
+    }
+
+    if (memcmp(results[0], results[1], bytes) != 0 || memcmp(results[0], results[2], bytes) != 0) {
+        printf("%sSprite kernels don't match the per pixel code%s\n", RED, RESET);
+    }
+
+    free(source);
+    free(layers);
+    free(classes);
+    for (int k = 0; k < 3; k++) free(results[k]);
+}
+
+
+
+// STARTUP
+
+/**
+ * Everything loaded before rendering, as a small graph of tasks run on a thread per core.
+ * A task starts once everything it depends on has finished, so independent loading (biomes,
+ * blockstates, textures, models...) overlaps instead of running one after another.
+ */
+typedef struct {
+    char* jar_path;
+    char* cache_root;
+    int extract;
+    int texture_parts; // block textures are decoded in this many tasks
+
+    AssetCache* asset_cache;
+} Startup;
+
+#define MAX_TASK_DEPENDENCIES 4
+
+typedef struct {
+    const char* name;
+    int (*run)(Startup* startup, void* arg); // returns 0 on success
+    void* arg;
+
+    int dependencies[MAX_TASK_DEPENDENCIES];
+    int dependency_count;
+
+    int state; // TASK_WAITING, ...
+    double start; // seconds since the graph started
+    double end;
+} StartupTask;
+
+#define TASK_WAITING 0
+#define TASK_RUNNING 1
+#define TASK_DONE 2
+#define TASK_FAILED 3 // or skipped because something it needs failed
+
+typedef struct {
+    StartupTask* tasks;
+    int count;
+    int capacity;
+    int finished;
+
+    Startup* startup;
+    double started;
+    double seconds;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} TaskGraph;
+
+TaskGraph* new_task_graph(Startup* startup) {
+    TaskGraph* graph = calloc(1, sizeof(TaskGraph));
+    graph->capacity = 16;
+    graph->tasks = malloc(graph->capacity * sizeof(StartupTask));
+    graph->startup = startup;
+    pthread_mutex_init(&graph->lock, NULL);
+    pthread_cond_init(&graph->changed, NULL);
+    return graph;
+}
+
+/**
+ * Adds a task and returns its index. The indexes of the tasks it needs follow 'arg', ended by -1.
+ */
+int add_startup_task(TaskGraph* graph, const char* name, int (*run)(Startup*, void*), void* arg, ...) {
+    if (graph->count == graph->capacity) {
+        graph->capacity *= 2;
+        graph->tasks = realloc(graph->tasks, graph->capacity * sizeof(StartupTask));
+    }
+    StartupTask* task = &graph->tasks[graph->count];
+    memset(task, 0, sizeof(StartupTask));
+    task->name = name;
+    task->run = run;
+    task->arg = arg;
+
+    va_list args;
+    va_start(args, arg);
+    for (int dependency = va_arg(args, int); dependency >= 0; dependency = va_arg(args, int)) {
+        if (task->dependency_count < MAX_TASK_DEPENDENCIES) {
+            task->dependencies[task->dependency_count++] = dependency;
+        }
+    }
+    va_end(args);
+
+    return graph->count++;
+}
+
+// the state a waiting task can move to, TASK_WAITING if it still has to wait
+static int task_readiness(TaskGraph* graph, StartupTask* task) {
+    int ready = TASK_RUNNING;
+    for (int d = 0; d < task->dependency_count; d++) {
+        int state = graph->tasks[task->dependencies[d]].state;
+        if (state == TASK_FAILED) return TASK_FAILED;
+        if (state != TASK_DONE) ready = TASK_WAITING;
+    }
+    return ready;
+}
+
+void* run_startup_tasks(void* arg) {
+    TaskGraph* graph = arg;
+
+    pthread_mutex_lock(&graph->lock);
+    while (graph->finished < graph->count) {
+        StartupTask* next = NULL;
+        for (int i = 0; i < graph->count && next == NULL; i++) {
+            StartupTask* task = &graph->tasks[i];
+            if (task->state != TASK_WAITING) continue;
+
+            int readiness = task_readiness(graph, task);
+            if (readiness == TASK_FAILED) {
+                task->state = TASK_FAILED;
+                graph->finished++;
+                pthread_cond_broadcast(&graph->changed);
+            }
+            else if (readiness == TASK_RUNNING) {
+                next = task;
+            }
+        }
+
+        if (next == NULL) {
+            if (graph->finished < graph->count) {
+                pthread_cond_wait(&graph->changed, &graph->lock);
+            }
+            continue;
+        }
+
+        next->state = TASK_RUNNING;
+        next->start = now_seconds() - graph->started;
+        pthread_mutex_unlock(&graph->lock);
+
+        int status = next->run(graph->startup, next->arg);
+
+        pthread_mutex_lock(&graph->lock);
+        next->end = now_seconds() - graph->started;
+        next->state = status == 0? TASK_DONE : TASK_FAILED;
+        graph->finished++;
+        pthread_cond_broadcast(&graph->changed);
+    }
+    pthread_mutex_unlock(&graph->lock);
+
+    return NULL;
+}
+
+/**
+ * Runs every task on 'thread_count' threads. Returns 0 if they all succeeded.
+ */
+int run_task_graph(TaskGraph* graph, int thread_count) {
+    graph->started = now_seconds();
+
+    pthread_t threads[thread_count];
+    for (int t = 0; t < thread_count; t++) {
+        pthread_create(&threads[t], NULL, run_startup_tasks, graph);
+    }
+    for (int t = 0; t < thread_count; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    graph->seconds = now_seconds() - graph->started;
+
+    for (int i = 0; i < graph->count; i++) {
+        if (graph->tasks[i].state != TASK_DONE) return 1;
+    }
+    return 0;
+}
+
+void print_task_graph(TaskGraph* graph) {
+    printf("\nSTARTUP %.1f ms\n", graph->seconds * 1000);
+    for (int i = 0; i < graph->count; i++) {
+        StartupTask* task = &graph->tasks[i];
+        if (task->state == TASK_DONE) {
+            printf("  %-16s %8.1f ms  (%.1f - %.1f ms)\n", task->name, (task->end - task->start) * 1000, task->start * 1000, task->end * 1000);
+        }
+        else {
+            printf("  %-16s   failed\n", task->name);
+        }
+    }
+}
+
+int startup_open_assets(Startup* startup, void* arg) {
+    (void)arg;
+    ASSETS = open_assets(startup->jar_path);
+    return ASSETS == NULL;
+}
+
+int startup_open_asset_cache(Startup* startup, void* arg) {
+    (void)arg;
+    startup->asset_cache = open_asset_cache(startup->cache_root, ASSETS);
+    return 0;
+}
+
+int startup_extract_jar(Startup* startup, void* arg) {
+    (void)arg;
+    extract_jar_to_cache(startup->asset_cache, startup->jar_path);
+    return 0;
+}
+
+int startup_init_texture_atlas(Startup* startup, void* arg) {
+    (void)startup;
+    (void)arg;
+    init_texture_atlas();
+    return 0;
+}
+
+// decodes one share of the block textures into the atlas
+int startup_decode_textures(Startup* startup, void* arg) {
+    int part = (int)(uintptr_t)arg;
+    char* prefix = CAT(TEXTURE_PATH, "block/", NULL);
+    int count;
+    char** pngs = list_assets(prefix, ".png", &count);
+    free(prefix);
+
+    for (int i = part; i < count; i += startup->texture_parts) {
+        // 'assets/minecraft/textures/block/stone.png' -> 'block/stone'
+        char name[256];
+        const char* start = pngs[i] + strlen(TEXTURE_PATH);
+        snprintf(name, sizeof(name), "%.*s", (int)(strlen(start) - strlen(".png")), start);
+        load_texture(name);
+    }
+    free(pngs);
+    return 0;
+}
+
+int startup_load_block_states(Startup* startup, void* arg) {
+    (void)startup;
+    (void)arg;
+    load_block_state_definitions();
+    return 0;
+}
+
+// parses and resolves every model a blockstate file uses
+int startup_resolve_models(Startup* startup, void* arg) {
+    (void)startup;
+    (void)arg;
+    Element** definitions = map_elements(BLOCK_STATE_DEFINITIONS);
+    for (size_t i = 0; i < BLOCK_STATE_DEFINITIONS->len; i++) {
+        BlockStateDefinition* definition = definitions[i]->data;
+        for (int c = 0; c < definition->case_count; c++) {
+            get_resolved_model(definition->cases[c].model);
+        }
+    }
+    free(definitions);
+    return 0;
+}
+
+int startup_load_biomes(Startup* startup, void* arg) {
+    (void)arg;
+    load_biomes(startup->asset_cache);
+    return 0;
+}
+
+int startup_build_tints(Startup* startup, void* arg) {
+    (void)startup;
+    (void)arg;
+    init_biome_tints();
+    return 0;
+}
+
+int startup_open_render_pack(Startup* startup, void* arg) {
+    (void)arg;
+    RENDER_PACK = open_render_pack(startup->asset_cache);
+    return 0;
+}
+
+int startup_open_sprite_cache(Startup* startup, void* arg) {
+    (void)arg;
+    SPRITE_CACHE = open_sprite_cache(startup->asset_cache);
+    return 0;
+}
+
+
+
 int main(int argc, char **argv) {
 
     // PARSE ARGS
@@ -2377,6 +5501,13 @@ int main(int argc, char **argv) {
     char *out_dir = NULL;
     char *angle = NULL;
     char *path = NULL;
+    int benchmark = 0;
+    int stats = 0;
+    int extract = 0;
+    int build_pack = 0;
+    int levels = 1;
+    int overview = 0;
+    char *cache_root = ".mapper_cache";
 
     ArgOption options[] = {
         {
@@ -2408,6 +5539,58 @@ int main(int argc, char **argv) {
             "The path to your minecraft world save folder. Minecraft worlds are saved in '.minecraft/saves/' as of 1.21.8", 
             &path
         },
+        {
+            "cache",    
+            'c', 
+            ARG_STRING, 
+            "Directory for work saved between runs, kept per jar version. Defaults to '.mapper_cache'.", 
+            &cache_root
+        },
+        {
+            "extract",    
+            'x', 
+            ARG_BOOL, 
+            "Also extract the jar's models and textures into the cache directory (only done once per jar).", 
+            &extract
+        },
+        {
+            "build-render-pack",    
+            'p', 
+            ARG_BOOL, 
+            "Render every block of the jar into a pack in the cache directory and exit. Later runs with the same jar"
+            " load blocks from the pack instead of rendering them.", 
+            &build_pack
+        },
+        {
+            "levels",    
+            'l', 
+            ARG_INT, 
+            "How many zoom levels to write, 1 to 4 (see 'index.html'). Level 0 is 16 pixels a block, the ones"
+            " after are drawn straight from the world at their own scale with smaller block sprites. Defaults to 1.", 
+            &levels
+        },
+        {
+            "overview",    
+            'v', 
+            ARG_BOOL, 
+            "Only write the zoomed out levels (1 and up), a quick overview of a big world.", 
+            &overview
+        },
+        {
+            "benchmark",    
+            'b', 
+            ARG_BOOL, 
+            "Time the hash maps and sprite kernels used by the mapper and exit.", 
+            &benchmark
+        },
+        {
+            "stats",    
+            's', 
+            ARG_BOOL, 
+            "Print the size and load of the mapper's caches after rendering. Build with -DMAP_STATS to also get"
+            " probe lengths and rehash times.", 
+            &stats
+        },
         // XXX: maybe add something to specify mca file directory, and other key directories for future minecraft version changes
 
         // {"verbose", 'v', ARG_BOOL,   "Enable verbose output", &verbose},
@@ -2415,13 +5598,60 @@ int main(int argc, char **argv) {
     };
     parse_args(argc, argv, options, len(options));
 
-    if (angle != NULL) {
-        ANGLE = angle;
+    if (benchmark) {
+        benchmark_maps();
+        benchmark_kernels();
+        return 0;
+    }
+
+    if (levels < 1 || levels > MAX_LEVELS || (overview && levels < 2)) {
+        printf("%s'--levels' has to be 1 to %d, and at least 2 with '--overview'.%s\n", RED, MAX_LEVELS, RESET);
+        return 1;
+    }
+
+    if (angle != NULL && !parse_angle(angle, &ANGLE)) {
+        printf("%s'%s' isn't a valid angle. Options are 'NE', 'SE', 'SW', 'NW'.%s\n", RED, angle, RESET);
+        return 1;
+    }
+
+    init_registries();
+    init_projection_tables();
+
+    // LOAD ASSETS
+    Startup startup = {0};
+    startup.jar_path = jar_path;
+    startup.cache_root = cache_root;
+    startup.texture_parts = cpu_count();
+
+    TaskGraph* graph = new_task_graph(&startup);
+    int zip = add_startup_task(graph, "zip index", startup_open_assets, NULL, -1);
+    int cache = add_startup_task(graph, "asset cache", startup_open_asset_cache, NULL, zip, -1);
+    int atlas = add_startup_task(graph, "texture atlas", startup_init_texture_atlas, NULL, zip, -1);
+    for (int i = 0; i < startup.texture_parts; i++) {
+        add_startup_task(graph, "textures", startup_decode_textures, (void*)(uintptr_t)i, atlas, -1);
+    }
+    int block_states = add_startup_task(graph, "blockstates", startup_load_block_states, NULL, zip, -1);
+    add_startup_task(graph, "models", startup_resolve_models, NULL, block_states, atlas, -1);
+    int biomes = add_startup_task(graph, "biomes", startup_load_biomes, NULL, cache, -1);
+    add_startup_task(graph, "tints", startup_build_tints, NULL, biomes, -1);
+    if (extract) {
+        add_startup_task(graph, "extract", startup_extract_jar, NULL, cache, -1);
+    }
+    if (!build_pack) {
+        add_startup_task(graph, "render pack", startup_open_render_pack, NULL, cache, -1);
+        add_startup_task(graph, "sprite cache", startup_open_sprite_cache, NULL, cache, -1);
     }
 
-    // extract minecraft jar and set paths to model files
-    extract_jar(jar_path, "dump/jar");
-    find_block_models();
+    int failed = run_task_graph(graph, cpu_count());
+    if (stats) {
+        print_task_graph(graph);
+    }
+    if (failed) {
+        return 1;
+    }
+    if (build_pack) {
+        return build_render_pack(startup.asset_cache);
+    }
 
 
 
@@ -2432,16 +5662,19 @@ int main(int argc, char **argv) {
     
 
     // SORT MCA FILES TO RENDER FARTHER FROM VIEWER FIRST
-    qsort(files, n, sizeof(char*), compare_mca_paths);
+    qsort(files, n, sizeof(char*), ANGLE_SPECS[ANGLE].compare_mca_paths);
     
 
     // init rendered block map
-    Map* block_tag_to_rendered_blocks = new_map();
+    ConcurrentMap* block_tag_to_rendered_blocks = new_concurrent_map();
+    Canvas* canvases[MAX_LEVELS];
+    int canvas_count = 0;
+    for (int level = overview? 1 : 0; level < levels; level++) {
+        canvases[canvas_count++] = new_canvas(out_dir != NULL? out_dir : "OUT", level);
+    }
     // get_rendered_block("minecraft:block/birch_stairs", block_tag_to_rendered_blocks);
 
 
-    // LOAD BIOME GRASS/WATER tints
-    Map* biome_name_to_biome_data = load_biomes();
 
 
 
@@ -2452,12 +5685,34 @@ int main(int argc, char **argv) {
         printf("  %s\n", files[i]);
 
         // print_region_to_file(files[i], "region.txt");
-        render_mca(files[i], block_tag_to_rendered_blocks, biome_name_to_biome_data);
+        render_mca(files[i], canvases, canvas_count, block_tag_to_rendered_blocks);
+        for (int c = 0; c < canvas_count; c++) {
+            if (canvases[c]->level == 0 || canvases[c]->tiles->len > MAX_OPEN_TILES) {
+                flush_canvas(canvases[c]);
+            }
+        }
 
         free(files[i]);
     }
+    for (int c = 0; c < canvas_count; c++) {
+        flush_canvas(canvases[c]);
+    }
     free(files);
     free(region_folder);
+    if (SPRITE_CACHE != NULL) {
+        close_sprite_cache(SPRITE_CACHE);
+    }
+
+    if (stats) {
+        printf("\nCACHE STATS\n");
+        print_concurrent_map_stats("rendered blocks", block_tag_to_rendered_blocks);
+        print_map_stats("block state ids", BLOCK_STATE_KEYS->name_to_id);
+        print_map_stats("biome ids", BIOME_NAMES->name_to_id);
+        printf("biomes: %d from the jar, %d seen\n", BIOMES_LEN, BIOME_NAMES->len);
+        if (SPRITE_CACHE != NULL) {
+            printf("sprite cache: %d loaded, %d added\n", SPRITE_CACHE->loaded, SPRITE_CACHE->appended);
+        }
+    }
 
 
     // START AT FARTHEST FROM VIEWPOINT